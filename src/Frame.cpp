@@ -3,6 +3,7 @@
 
 #include <cstring>
 #include <cstdarg>
+#include <cstdint>
 #include <stdexcept>
 
 #include <glm/common.hpp>
@@ -11,6 +12,8 @@
 #include <GLFW/glfw3.h>
 
 #include "Logger.hpp"
+#include "recorder.hpp"
+#include "state_cache.hpp"
 
 #define FORWARD_CB(func, ...) Frame* f = reinterpret_cast<Frame*>(glfwGetWindowUserPointer(window));\
 	f->func(__VA_ARGS__);\
@@ -288,6 +291,9 @@ Frame::Frame(int width, int height, std::string_view title)
 		throw FrameException();
 	}
 
+	// a new context starts from defaults the shadow knows nothing about
+	StateCache::get().invalidate();
+
 	// set opengl debug callbacks
 #ifndef NDEBUG
 	glad_set_pre_callback(on_glad_pre_call);
@@ -361,6 +367,48 @@ void Frame::run(int tick_hz, int max_frame_hz)
 	}
 }
 
+void Frame::record(int tick_hz, std::size_t frames, Recorder& recorder)
+{
+	assert(tick_hz > 0);
+	assert(recorder.frames_per_second() > 0);
+
+	const std::uint64_t ticks_per_second = tick_hz;
+	const std::uint64_t frames_per_second = recorder.frames_per_second();
+	const double tick = 1.0 / tick_hz;
+
+	// the raw timer is unaffected by set_time()
+	const double real_time = time();
+	const std::uint64_t real_timer = glfwGetTimerValue();
+
+	std::uint64_t ticks_done = 0;
+	for (std::uint64_t i = 0; i < frames && is_open(); ++i)
+	{
+		// time() reports virtual time to the callbacks
+		set_time(static_cast<double>(i) / frames_per_second);
+
+		on_input();
+
+		// whole ticks by the end of this frame, exact for any rate ratio
+		const std::uint64_t ticks_due = (i + 1) * ticks_per_second / frames_per_second;
+		for (; ticks_done < ticks_due; ++ticks_done)
+			on_tick(tick);
+
+		// time past the last tick, as run() passes it
+		const std::uint64_t remainder = (i + 1) * ticks_per_second - ticks_due * frames_per_second;
+		on_render(static_cast<double>(remainder) / (frames_per_second * ticks_per_second));
+
+		recorder.capture();
+		swap_buffers();
+		update();
+		recorder.poll();
+	}
+
+	recorder.finish();
+
+	const double elapsed = static_cast<double>(glfwGetTimerValue() - real_timer) / glfwGetTimerFrequency();
+	set_time(real_time + elapsed);
+}
+
 void Frame::on_key([[maybe_unused]] Key k, [[maybe_unused]] InputAction action, [[maybe_unused]] InputModifier mods)
 {
 }
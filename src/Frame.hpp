@@ -196,6 +196,8 @@ constexpr auto operator&=(InputModifier& a, InputModifier b) noexcept
 	return a = (a & b);
 }
 
+class Recorder;
+
 class FrameException : public std::runtime_error
 {
 public:
@@ -219,6 +221,9 @@ public:
 	virtual void on_render(float dt);
 	virtual void run(int ticks_per_second, int fps_cap);
 
+	// offline loop at a fixed virtual timestep, every frame is captured
+	virtual void record(int ticks_per_second, std::size_t frames, Recorder& recorder);
+
 	// input events
 	virtual void on_key(Key k, InputAction action, InputModifier mods);
 	virtual void on_char(unsigned int codepoint);
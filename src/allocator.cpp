@@ -0,0 +1,332 @@
+// allocator.cpp
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace ori
+{
+
+static auto msb(std::uint64_t value) noexcept -> unsigned
+{
+#if __GNUC__
+	return 63 - __builtin_clzll(value);
+#else
+	unsigned bit = 0;
+	while (value >>= 1)
+		++bit;
+	return bit;
+#endif
+}
+
+static auto lsb(std::uint64_t value) noexcept -> unsigned
+{
+#if __GNUC__
+	return __builtin_ctzll(value);
+#else
+	unsigned bit = 0;
+	while (!(value & 1))
+	{
+		value >>= 1;
+		++bit;
+	}
+	return bit;
+#endif
+}
+
+RangeAllocator::RangeAllocator(std::size_t capacity)
+{
+	bins.fill(invalid);
+	grow(capacity);
+}
+
+auto RangeAllocator::allocate(std::size_t size) -> std::uint32_t
+{
+	size = std::max<std::size_t>(size, 1);
+
+	auto node = find_free(size);
+	if (node == invalid)
+		return invalid;
+
+	remove_free(node);
+
+	// split off the remainder
+	if (nodes[node].size > size)
+	{
+		auto rest = create_node(nodes[node].offset + size, nodes[node].size - size);
+		nodes[rest].prev_phys = node;
+		nodes[rest].next_phys = nodes[node].next_phys;
+		if (nodes[rest].next_phys != invalid)
+			nodes[nodes[rest].next_phys].prev_phys = rest;
+		else
+			last = rest;
+		nodes[node].next_phys = rest;
+		nodes[node].size = size;
+		insert_free(rest);
+	}
+
+	nodes[node].used = true;
+	_free_space -= size;
+	return node;
+}
+
+void RangeAllocator::free(std::uint32_t range)
+{
+	assert(range < nodes.size() && nodes[range].used);
+
+	auto node = range;
+	nodes[node].used = false;
+	_free_space += nodes[node].size;
+
+	// merge with the physically next range
+	auto next = nodes[node].next_phys;
+	if (next != invalid && !nodes[next].used)
+	{
+		remove_free(next);
+		nodes[node].size += nodes[next].size;
+		nodes[node].next_phys = nodes[next].next_phys;
+		if (nodes[node].next_phys != invalid)
+			nodes[nodes[node].next_phys].prev_phys = node;
+		else
+			last = node;
+		destroy_node(next);
+	}
+
+	// merge with the physically previous range
+	auto prev = nodes[node].prev_phys;
+	if (prev != invalid && !nodes[prev].used)
+	{
+		remove_free(prev);
+		nodes[prev].size += nodes[node].size;
+		nodes[prev].next_phys = nodes[node].next_phys;
+		if (nodes[prev].next_phys != invalid)
+			nodes[nodes[prev].next_phys].prev_phys = prev;
+		else
+			last = prev;
+		destroy_node(node);
+		node = prev;
+	}
+
+	insert_free(node);
+}
+
+void RangeAllocator::grow(std::size_t capacity)
+{
+	if (capacity <= _capacity)
+		return;
+
+	const std::size_t extra = capacity - _capacity;
+
+	if (last != invalid && !nodes[last].used)
+	{
+		remove_free(last);
+		nodes[last].size += extra;
+		insert_free(last);
+	}
+	else
+	{
+		auto node = create_node(_capacity, extra);
+		nodes[node].prev_phys = last;
+		if (last != invalid)
+			nodes[last].next_phys = node;
+		else
+			first = node;
+		last = node;
+		insert_free(node);
+	}
+
+	_capacity = capacity;
+	_free_space += extra;
+}
+
+auto RangeAllocator::defragment() -> std::vector<RangeMove>
+{
+	std::vector<RangeMove> moves;
+	std::vector<std::uint32_t> live;
+	std::size_t cursor = 0;
+
+	for (auto node = first; node != invalid; )
+	{
+		auto next = nodes[node].next_phys;
+
+		if (nodes[node].used)
+		{
+			auto& n = nodes[node];
+			if (!moves.empty()
+				&& moves.back().source + moves.back().size == n.offset
+				&& moves.back().destination + moves.back().size == cursor)
+				moves.back().size += n.size;
+			else
+				moves.push_back({n.offset, cursor, n.size});
+
+			n.offset = cursor;
+			cursor += n.size;
+			live.push_back(node);
+		}
+		else
+		{
+			destroy_node(node);
+		}
+
+		node = next;
+	}
+
+	// relink live ranges in address order
+	bins.fill(invalid);
+	sl_bitmaps.fill(0);
+	fl_bitmap = 0;
+	first = last = invalid;
+
+	for (auto node : live)
+	{
+		nodes[node].prev_phys = last;
+		nodes[node].next_phys = invalid;
+		if (last != invalid)
+			nodes[last].next_phys = node;
+		else
+			first = node;
+		last = node;
+	}
+
+	// one free range at the back
+	auto capacity = _capacity;
+	_capacity = cursor;
+	_free_space = 0;
+	grow(capacity);
+
+	return moves;
+}
+
+auto RangeAllocator::offset(std::uint32_t range) const noexcept -> std::size_t
+{
+	return nodes[range].offset;
+}
+
+auto RangeAllocator::size(std::uint32_t range) const noexcept -> std::size_t
+{
+	return nodes[range].size;
+}
+
+auto RangeAllocator::capacity() const noexcept -> std::size_t
+{
+	return _capacity;
+}
+
+auto RangeAllocator::free_space() const noexcept -> std::size_t
+{
+	return _free_space;
+}
+
+auto RangeAllocator::create_node(std::size_t offset, std::size_t size) -> std::uint32_t
+{
+	std::uint32_t node;
+	if (!unused_nodes.empty())
+	{
+		node = unused_nodes.back();
+		unused_nodes.pop_back();
+	}
+	else
+	{
+		node = static_cast<std::uint32_t>(nodes.size());
+		nodes.emplace_back();
+	}
+
+	nodes[node] = Node();
+	nodes[node].offset = offset;
+	nodes[node].size = size;
+	return node;
+}
+
+void RangeAllocator::destroy_node(std::uint32_t node)
+{
+	nodes[node] = Node();
+	unused_nodes.push_back(node);
+}
+
+// Size class of a free range, rounded down
+static auto bin_index(std::size_t size, unsigned sl_bits) noexcept -> std::pair<unsigned, unsigned>
+{
+	const std::size_t sl_count = std::size_t(1) << sl_bits;
+	if (size < sl_count)
+		return {0, static_cast<unsigned>(size)};
+
+	auto bit = msb(size);
+	return {bit - sl_bits + 1, static_cast<unsigned>((size >> (bit - sl_bits)) - sl_count)};
+}
+
+void RangeAllocator::insert_free(std::uint32_t node)
+{
+	auto [fl, sl] = bin_index(nodes[node].size, sl_bits);
+	auto& head = bins[fl * sl_count + sl];
+
+	nodes[node].prev_free = invalid;
+	nodes[node].next_free = head;
+	if (head != invalid)
+		nodes[head].prev_free = node;
+	head = node;
+
+	sl_bitmaps[fl] |= 1u << sl;
+	fl_bitmap |= std::uint64_t(1) << fl;
+}
+
+void RangeAllocator::remove_free(std::uint32_t node)
+{
+	auto& n = nodes[node];
+
+	if (n.prev_free != invalid)
+		nodes[n.prev_free].next_free = n.next_free;
+	if (n.next_free != invalid)
+		nodes[n.next_free].prev_free = n.prev_free;
+
+	auto [fl, sl] = bin_index(n.size, sl_bits);
+	auto& head = bins[fl * sl_count + sl];
+	if (head == node)
+	{
+		head = n.next_free;
+		if (head == invalid)
+		{
+			sl_bitmaps[fl] &= ~(1u << sl);
+			if (sl_bitmaps[fl] == 0)
+				fl_bitmap &= ~(std::uint64_t(1) << fl);
+		}
+	}
+
+	n.prev_free = invalid;
+	n.next_free = invalid;
+}
+
+auto RangeAllocator::find_free(std::size_t size) const noexcept -> std::uint32_t
+{
+	// round up to the next size class so any range in the bin fits
+	auto rounded = size;
+	if (rounded >= sl_count)
+		rounded += (std::size_t(1) << (msb(rounded) - sl_bits)) - 1;
+
+	auto [fl, sl] = bin_index(rounded, sl_bits);
+	std::uint32_t sl_map = fl < fl_count ? sl_bitmaps[fl] & (~0u << sl) : 0;
+	if (sl_map == 0)
+	{
+		auto fl_map = fl + 1 < fl_count ? fl_bitmap & (~std::uint64_t(0) << (fl + 1)) : 0;
+		if (fl_map != 0)
+		{
+			fl = lsb(fl_map);
+			sl_map = sl_bitmaps[fl];
+		}
+	}
+
+	if (sl_map != 0)
+		return bins[fl * sl_count + lsb(sl_map)];
+
+	// fall back to searching the size's own class
+	auto [exact_fl, exact_sl] = bin_index(size, sl_bits);
+	for (auto node = bins[exact_fl * sl_count + exact_sl]; node != invalid; node = nodes[node].next_free)
+	{
+		if (nodes[node].size >= size)
+			return node;
+	}
+
+	return invalid;
+}
+
+} // namespace ori
@@ -0,0 +1,84 @@
+// allocator.hpp
+#ifndef ALLOCATOR_HPP_
+#define ALLOCATOR_HPP_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace ori
+{
+
+/*
+ * A live range relocated by RangeAllocator::defragment
+ */
+struct RangeMove
+{
+	std::size_t source = 0;
+	std::size_t destination = 0;
+	std::size_t size = 0;
+};
+
+/*
+ * Two level segregated fit (TLSF) allocator over an abstract address range
+ * Holds no memory itself, used to sub-allocate large gpu buffers
+ * Allocation and release are O(1), handles stay valid across defragmentation
+ */
+class RangeAllocator
+{
+public:
+	static constexpr std::uint32_t invalid = ~std::uint32_t(0);
+
+	explicit RangeAllocator(std::size_t capacity);
+
+	// Returns invalid when no free range is large enough
+	auto allocate(std::size_t size) -> std::uint32_t;
+	void free(std::uint32_t range);
+
+	// Extend the address range, existing ranges are unaffected
+	void grow(std::size_t capacity);
+
+	// Pack all live ranges to the front, returns the (coalesced) moves
+	auto defragment() -> std::vector<RangeMove>;
+
+	auto offset(std::uint32_t range) const noexcept -> std::size_t;
+	auto size(std::uint32_t range) const noexcept -> std::size_t;
+	auto capacity() const noexcept -> std::size_t;
+	auto free_space() const noexcept -> std::size_t;
+
+private:
+	static constexpr unsigned sl_bits = 4;
+	static constexpr unsigned sl_count = 1 << sl_bits;
+	static constexpr unsigned fl_count = 64;
+
+	struct Node
+	{
+		std::size_t offset = 0;
+		std::size_t size = 0;
+		std::uint32_t prev_phys = invalid;
+		std::uint32_t next_phys = invalid;
+		std::uint32_t prev_free = invalid;
+		std::uint32_t next_free = invalid;
+		bool used = false;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<std::uint32_t> unused_nodes;
+	std::array<std::uint32_t, fl_count * sl_count> bins;
+	std::array<std::uint16_t, fl_count> sl_bitmaps = {};
+	std::uint64_t fl_bitmap = 0;
+	std::uint32_t first = invalid;
+	std::uint32_t last = invalid;
+	std::size_t _capacity = 0;
+	std::size_t _free_space = 0;
+
+	auto create_node(std::size_t offset, std::size_t size) -> std::uint32_t;
+	void destroy_node(std::uint32_t node);
+	void insert_free(std::uint32_t node);
+	void remove_free(std::uint32_t node);
+	auto find_free(std::size_t size) const noexcept -> std::uint32_t;
+};
+
+} // namespace ori
+
+#endif // ALLOCATOR_HPP_
@@ -0,0 +1,439 @@
+// culling.cpp
+#include "culling.hpp"
+
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <glad/glad.h>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+namespace ori
+{
+
+static constexpr const char* cull_source = R"(
+#version 460
+layout(local_size_x = 64) in;
+
+struct Command
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+
+struct Bounds
+{
+	vec4 sphere;
+	uint draw;
+	uint padding[3];
+};
+
+layout(std430, binding = 0) readonly buffer BoundsBlock { Bounds bounds[]; };
+layout(std430, binding = 1) buffer CommandBlock { Command commands[]; };
+layout(std430, binding = 2) writeonly buffer VisibleBlock { uint visible[]; };
+layout(std430, binding = 3) writeonly buffer CompactedBlock { Command compacted[]; };
+layout(std430, binding = 4) buffer CountBlock { uint draw_count; };
+
+layout(location = 0) uniform vec4 planes[6];
+layout(location = 6) uniform uint count;
+layout(location = 7) uniform uint pass;
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= count)
+		return;
+
+	if (pass == 0u)
+	{
+		vec4 sphere = bounds[i].sphere;
+		for (int p = 0; p < 6; ++p)
+		{
+			if (dot(planes[p].xyz, sphere.xyz) + planes[p].w < -sphere.w)
+				return;
+		}
+
+		uint draw = bounds[i].draw;
+		uint slot = atomicAdd(commands[draw].instance_count, 1u);
+		visible[commands[draw].base_instance + slot] = i;
+	}
+	else if (commands[i].instance_count > 0u)
+	{
+		compacted[atomicAdd(draw_count, 1u)] = commands[i];
+	}
+}
+)";
+
+static constexpr std::uint32_t cull_group_size = 64;
+
+auto frustum_planes(const glm::mat4& view_projection) noexcept -> CullPlanes
+{
+	const auto x = glm::row(view_projection, 0);
+	const auto y = glm::row(view_projection, 1);
+	const auto z = glm::row(view_projection, 2);
+	const auto w = glm::row(view_projection, 3);
+
+	CullPlanes planes = {w + x, w - x, w + y, w - y, w + z, w - z};
+	for (auto& plane : planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	return planes;
+}
+
+auto viewport_planes(const Rect2D& viewport) noexcept -> CullPlanes
+{
+	return {
+		glm::vec4(1.0f, 0.0f, 0.0f, -left_edge(viewport)),
+		glm::vec4(-1.0f, 0.0f, 0.0f, right_edge(viewport)),
+		glm::vec4(0.0f, 1.0f, 0.0f, -bottom_edge(viewport)),
+		glm::vec4(0.0f, -1.0f, 0.0f, top_edge(viewport)),
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)};
+}
+
+static auto cull_shaders() -> ShaderVec
+{
+	std::vector<Shader> shaders;
+	shaders.emplace_back(ComputeShader(cull_source));
+	return ShaderVec(std::move(shaders));
+}
+
+namespace
+{
+
+/*
+ * The few vector operations the cpu cull loops need, one lane per object
+ */
+#if defined(__AVX__)
+struct Simd
+{
+	using reg = __m256;
+	static constexpr std::size_t width = 8;
+
+	static auto load(const float* p) noexcept -> reg { return _mm256_loadu_ps(p); }
+	static auto set(float f) noexcept -> reg { return _mm256_set1_ps(f); }
+	static auto add(reg a, reg b) noexcept -> reg { return _mm256_add_ps(a, b); }
+	static auto mul(reg a, reg b) noexcept -> reg { return _mm256_mul_ps(a, b); }
+	static auto both(reg a, reg b) noexcept -> reg { return _mm256_and_ps(a, b); }
+	static auto greater_equal(reg a, reg b) noexcept -> reg { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	static auto bits(reg mask) noexcept -> unsigned { return _mm256_movemask_ps(mask); }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+struct Simd
+{
+	using reg = __m128;
+	static constexpr std::size_t width = 4;
+
+	static auto load(const float* p) noexcept -> reg { return _mm_loadu_ps(p); }
+	static auto set(float f) noexcept -> reg { return _mm_set1_ps(f); }
+	static auto add(reg a, reg b) noexcept -> reg { return _mm_add_ps(a, b); }
+	static auto mul(reg a, reg b) noexcept -> reg { return _mm_mul_ps(a, b); }
+	static auto both(reg a, reg b) noexcept -> reg { return _mm_and_ps(a, b); }
+	static auto greater_equal(reg a, reg b) noexcept -> reg { return _mm_cmpge_ps(a, b); }
+	static auto bits(reg mask) noexcept -> unsigned { return _mm_movemask_ps(mask); }
+};
+#elif defined(__ARM_NEON)
+struct Simd
+{
+	using reg = float32x4_t;
+	static constexpr std::size_t width = 4;
+
+	static auto load(const float* p) noexcept -> reg { return vld1q_f32(p); }
+	static auto set(float f) noexcept -> reg { return vdupq_n_f32(f); }
+	static auto add(reg a, reg b) noexcept -> reg { return vaddq_f32(a, b); }
+	static auto mul(reg a, reg b) noexcept -> reg { return vmulq_f32(a, b); }
+
+	static auto both(reg a, reg b) noexcept -> reg
+	{
+		return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+	}
+
+	static auto greater_equal(reg a, reg b) noexcept -> reg
+	{
+		return vreinterpretq_f32_u32(vcgeq_f32(a, b));
+	}
+
+	static auto bits(reg mask) noexcept -> unsigned
+	{
+		static const std::uint32_t lane_bits[4] = {1, 2, 4, 8};
+		auto m = vandq_u32(vreinterpretq_u32_f32(mask), vld1q_u32(lane_bits));
+		return vgetq_lane_u32(m, 0) | vgetq_lane_u32(m, 1) | vgetq_lane_u32(m, 2) | vgetq_lane_u32(m, 3);
+	}
+};
+#else
+struct Simd
+{
+	using reg = float;
+	static constexpr std::size_t width = 1;
+
+	static auto load(const float* p) noexcept -> reg { return *p; }
+	static auto set(float f) noexcept -> reg { return f; }
+	static auto add(reg a, reg b) noexcept -> reg { return a + b; }
+	static auto mul(reg a, reg b) noexcept -> reg { return a * b; }
+	static auto both(reg a, reg b) noexcept -> reg { return a != 0.0f && b != 0.0f ? 1.0f : 0.0f; }
+	static auto greater_equal(reg a, reg b) noexcept -> reg { return a >= b ? 1.0f : 0.0f; }
+	static auto bits(reg mask) noexcept -> unsigned { return mask != 0.0f ? 1u : 0u; }
+};
+#endif
+
+// Storage is padded to this many entries so every vector load stays in bounds
+constexpr std::size_t cull_padding = 8;
+static_assert(cull_padding % Simd::width == 0);
+
+} // namespace
+
+static void push_visible(unsigned bits, std::size_t first, std::vector<std::uint32_t>& visible)
+{
+	for (std::size_t lane = 0; bits != 0; ++lane, bits >>= 1)
+	{
+		if (bits & 1)
+			visible.push_back(first + lane);
+	}
+}
+
+// Grow to hold index, padding entries hold value so they never pass a test
+static void ensure_size(std::vector<float>& values, std::size_t index, float value)
+{
+	if (index >= values.size())
+		values.resize((index / cull_padding + 1) * cull_padding, value);
+}
+
+auto Bounds2D::add(const Rect2D& rect) -> std::uint32_t
+{
+	set(count, rect);
+	return count - 1;
+}
+
+void Bounds2D::set(std::uint32_t index, const Rect2D& rect)
+{
+	constexpr float inf = std::numeric_limits<float>::infinity();
+	ensure_size(min_x, index, inf);
+	ensure_size(min_y, index, inf);
+	ensure_size(max_x, index, -inf);
+	ensure_size(max_y, index, -inf);
+
+	min_x[index] = left_edge(rect);
+	min_y[index] = bottom_edge(rect);
+	max_x[index] = right_edge(rect);
+	max_y[index] = top_edge(rect);
+	count = std::max<std::size_t>(count, index + 1);
+}
+
+void Bounds2D::clear() noexcept
+{
+	min_x.clear();
+	min_y.clear();
+	max_x.clear();
+	max_y.clear();
+	count = 0;
+}
+
+void Bounds2D::cull(const Rect2D& viewport, std::vector<std::uint32_t>& visible) const
+{
+	visible.clear();
+	visible.reserve(count);
+
+	const auto left = Simd::set(left_edge(viewport));
+	const auto bottom = Simd::set(bottom_edge(viewport));
+	const auto right = Simd::set(right_edge(viewport));
+	const auto top = Simd::set(top_edge(viewport));
+
+	for (std::size_t first = 0; first < count; first += Simd::width)
+	{
+		auto inside = Simd::greater_equal(Simd::load(&max_x[first]), left);
+		inside = Simd::both(inside, Simd::greater_equal(Simd::load(&max_y[first]), bottom));
+		inside = Simd::both(inside, Simd::greater_equal(right, Simd::load(&min_x[first])));
+		inside = Simd::both(inside, Simd::greater_equal(top, Simd::load(&min_y[first])));
+		push_visible(Simd::bits(inside), first, visible);
+	}
+}
+
+auto Bounds2D::size() const noexcept -> std::size_t
+{
+	return count;
+}
+
+auto Bounds3D::add(glm::vec3 min, glm::vec3 max) -> std::uint32_t
+{
+	set(count, min, max);
+	return count - 1;
+}
+
+void Bounds3D::set(std::uint32_t index, glm::vec3 min, glm::vec3 max)
+{
+	// NaN compares false against every plane
+	constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+	for (auto* values : {&center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z})
+		ensure_size(*values, index, nan);
+
+	const auto center = (min + max) * 0.5f;
+	const auto extent = (max - min) * 0.5f;
+	center_x[index] = center.x;
+	center_y[index] = center.y;
+	center_z[index] = center.z;
+	extent_x[index] = extent.x;
+	extent_y[index] = extent.y;
+	extent_z[index] = extent.z;
+	count = std::max<std::size_t>(count, index + 1);
+}
+
+void Bounds3D::clear() noexcept
+{
+	for (auto* values : {&center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z})
+		values->clear();
+	count = 0;
+}
+
+void Bounds3D::cull(const CullPlanes& planes, std::vector<std::uint32_t>& visible) const
+{
+	visible.clear();
+	visible.reserve(count);
+
+	const auto zero = Simd::set(0.0f);
+
+	for (std::size_t first = 0; first < count; first += Simd::width)
+	{
+		const auto cx = Simd::load(&center_x[first]);
+		const auto cy = Simd::load(&center_y[first]);
+		const auto cz = Simd::load(&center_z[first]);
+		const auto ex = Simd::load(&extent_x[first]);
+		const auto ey = Simd::load(&extent_y[first]);
+		const auto ez = Simd::load(&extent_z[first]);
+
+		// A box is outside a plane when its center is further out than its projected extent
+		auto inside = Simd::greater_equal(zero, zero);
+		for (const auto& plane : planes)
+		{
+			auto distance = Simd::add(Simd::mul(cx, Simd::set(plane.x)), Simd::set(plane.w));
+			distance = Simd::add(distance, Simd::mul(cy, Simd::set(plane.y)));
+			distance = Simd::add(distance, Simd::mul(cz, Simd::set(plane.z)));
+			distance = Simd::add(distance, Simd::mul(ex, Simd::set(std::abs(plane.x))));
+			distance = Simd::add(distance, Simd::mul(ey, Simd::set(std::abs(plane.y))));
+			distance = Simd::add(distance, Simd::mul(ez, Simd::set(std::abs(plane.z))));
+			inside = Simd::both(inside, Simd::greater_equal(distance, zero));
+		}
+
+		push_visible(Simd::bits(inside), first, visible);
+	}
+}
+
+void Bounds3D::cull(const glm::mat4& view_projection, std::vector<std::uint32_t>& visible) const
+{
+	cull(frustum_planes(view_projection), visible);
+}
+
+auto Bounds3D::size() const noexcept -> std::size_t
+{
+	return count;
+}
+
+// Instance counts start at zero, the cull pass fills them in
+static auto empty_draws(std::vector<DrawElementsCommand> draws) -> std::vector<DrawElementsCommand>
+{
+	for (auto& draw : draws)
+		draw.instance_count = 0;
+	return draws;
+}
+
+static auto zeroed(std::size_t size_bytes) -> std::vector<std::byte>
+{
+	return std::vector<std::byte>(std::max<std::size_t>(size_bytes, 4));
+}
+
+GpuCuller::GpuCuller(const std::vector<DrawElementsCommand>& draws, std::size_t instances)
+: program(cull_shaders())
+, templates(gsl::as_bytes(gsl::span<const DrawElementsCommand>(empty_draws(draws))))
+, working(zeroed(draws.size() * sizeof(DrawElementsCommand)))
+, compacted(zeroed(draws.size() * sizeof(DrawElementsCommand)))
+, count(zeroed(sizeof(std::uint32_t)))
+, visible(zeroed(instances * sizeof(std::uint32_t)))
+, _draws(draws.size())
+, _instances(instances)
+{
+}
+
+void GpuCuller::cull(const BufferBase& bounds, const glm::mat4& view_projection)
+{
+	cull(bounds, frustum_planes(view_projection));
+}
+
+void GpuCuller::cull(const BufferBase& bounds, const Rect2D& viewport)
+{
+	cull(bounds, viewport_planes(viewport));
+}
+
+void GpuCuller::cull(const BufferBase& bounds, const CullPlanes& planes)
+{
+	const auto instance_count = std::min(_instances, bounds.size_bytes() / sizeof(CullBounds));
+
+	glCopyNamedBufferSubData(templates.id(), working.id(), 0, 0, _draws * sizeof(DrawElementsCommand));
+	glClearNamedBufferSubData(count.id(), GL_R32UI, 0, sizeof(std::uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	for (std::size_t i = 0; i < planes.size(); ++i)
+		program.set_uniform(i, planes[i]);
+
+	program.bind();
+	bounds.bind_to_storage(0);
+	working.bind_to_storage(1);
+	visible.bind_to_storage(2);
+	compacted.bind_to_storage(3);
+	count.bind_to_storage(4);
+
+	// Cull instances into their draws
+	program.set_uniform(6, static_cast<unsigned>(instance_count));
+	program.set_uniform(7, 0u);
+	glDispatchCompute((instance_count + cull_group_size - 1) / cull_group_size, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Compact the draws that kept any instances
+	program.set_uniform(6, static_cast<unsigned>(_draws));
+	program.set_uniform(7, 1u);
+	glDispatchCompute((_draws + cull_group_size - 1) / cull_group_size, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void GpuCuller::draw() const
+{
+	if (supports_indirect_count())
+		draw_triangles_indirect_count(compacted, count, _draws);
+	else
+		draw_triangles_indirect(working, _draws);
+}
+
+void GpuCuller::bind_visible(std::size_t index) const
+{
+	visible.bind_to_storage(index);
+}
+
+auto GpuCuller::commands() const noexcept -> const BufferBase&
+{
+	return compacted;
+}
+
+auto GpuCuller::draw_count() const noexcept -> const BufferBase&
+{
+	return count;
+}
+
+auto GpuCuller::draws() const noexcept -> std::size_t
+{
+	return _draws;
+}
+
+auto GpuCuller::instances() const noexcept -> std::size_t
+{
+	return _instances;
+}
+
+} // namespace ori
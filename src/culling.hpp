@@ -0,0 +1,131 @@
+// culling.hpp
+#ifndef CULLING_HPP_
+#define CULLING_HPP_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "rect.hpp"
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+// Planes as (normal, distance), a point p is inside when dot(normal, p) + distance >= 0
+using CullPlanes = std::array<glm::vec4, 6>;
+
+// Left, right, bottom, top, near and far planes of a view projection matrix
+auto frustum_planes(const glm::mat4& view_projection) noexcept -> CullPlanes;
+
+// Edges of a 2D viewport, z is unbounded
+auto viewport_planes(const Rect2D& viewport) noexcept -> CullPlanes;
+
+/*
+ * Rect2D bounds in structure-of-arrays form, culled several at a time with
+ * SSE, AVX or NEON when the compiler targets them and one at a time otherwise
+ */
+class Bounds2D
+{
+public:
+	auto add(const Rect2D& rect) -> std::uint32_t;
+	void set(std::uint32_t index, const Rect2D& rect);
+	void clear() noexcept;
+
+	// Replace visible with the indices of every rect overlapping viewport
+	void cull(const Rect2D& viewport, std::vector<std::uint32_t>& visible) const;
+
+	auto size() const noexcept -> std::size_t;
+
+private:
+	std::vector<float> min_x;
+	std::vector<float> min_y;
+	std::vector<float> max_x;
+	std::vector<float> max_y;
+	std::size_t count = 0;
+};
+
+/*
+ * Axis aligned boxes in structure-of-arrays form, stored as center and extent
+ */
+class Bounds3D
+{
+public:
+	auto add(glm::vec3 min, glm::vec3 max) -> std::uint32_t;
+	void set(std::uint32_t index, glm::vec3 min, glm::vec3 max);
+	void clear() noexcept;
+
+	// Replace visible with the indices of every box at least partly inside planes
+	void cull(const CullPlanes& planes, std::vector<std::uint32_t>& visible) const;
+	void cull(const glm::mat4& view_projection, std::vector<std::uint32_t>& visible) const;
+
+	auto size() const noexcept -> std::size_t;
+
+private:
+	std::vector<float> center_x;
+	std::vector<float> center_y;
+	std::vector<float> center_z;
+	std::vector<float> extent_x;
+	std::vector<float> extent_y;
+	std::vector<float> extent_z;
+	std::size_t count = 0;
+};
+
+/*
+ * Bounding sphere of one instance, matches the std430 layout of the cull shader
+ */
+struct CullBounds
+{
+	glm::vec4 sphere = glm::vec4(0.0f); // center xyz, radius w
+	std::uint32_t draw = 0;              // index of the draw this instance belongs to
+	std::uint32_t padding[3] = {};
+};
+
+/*
+ * Frustum culling on the gpu
+ *
+ * Draw i owns the instances [base_instance, base_instance + instance_count)
+ * of the visible list. Every cull() rewrites that list with the indices of
+ * the surviving CullBounds and compacts the non-empty draws with their draw
+ * count, so a frame needs no per object cpu work. Vertex shaders look up
+ * their instance through visible[gl_BaseInstance + gl_InstanceID].
+ */
+class GpuCuller
+{
+public:
+	GpuCuller(const std::vector<DrawElementsCommand>& draws, std::size_t instances);
+
+	// bounds holds one CullBounds per instance
+	void cull(const BufferBase& bounds, const glm::mat4& view_projection);
+	void cull(const BufferBase& bounds, const Rect2D& viewport);
+	void cull(const BufferBase& bounds, const CullPlanes& planes);
+
+	// Draw the surviving instances with the currently bound Mesh or MeshPool
+	void draw() const;
+
+	// Bind the visible instance indices for the vertex shader
+	void bind_visible(std::size_t index) const;
+
+	auto commands() const noexcept -> const BufferBase&;
+	auto draw_count() const noexcept -> const BufferBase&;
+	auto draws() const noexcept -> std::size_t;
+	auto instances() const noexcept -> std::size_t;
+
+private:
+	ShaderProgram program;
+	BufferBase templates;
+	BufferBase working;
+	BufferBase compacted;
+	BufferBase count;
+	BufferBase visible;
+	std::size_t _draws;
+	std::size_t _instances;
+};
+
+} // namespace ori
+
+#endif // CULLING_HPP_
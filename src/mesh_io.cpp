@@ -0,0 +1,494 @@
+// mesh_io.cpp
+#include "mesh_io.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+#include "mesh_processing.hpp"
+
+namespace ori
+{
+
+MeshFileException::MeshFileException()
+: std::runtime_error("Mesh file exception")
+{
+}
+
+static auto read_file(const std::string& path) -> std::string
+{
+	auto file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		Logger::get().error({"Unable to open {}"}, path);
+		throw MeshFileException();
+	}
+
+	std::string contents;
+	std::array<char, 65536> chunk;
+	std::size_t count = 0;
+	while ((count = std::fread(chunk.data(), 1, chunk.size(), file)) > 0)
+		contents.append(chunk.data(), count);
+
+	std::fclose(file);
+	return contents;
+}
+
+static auto skip_spaces(const char* p, const char* end) noexcept -> const char*
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
+}
+
+static auto parse_floats(const char* p, const char* end, float* values, int count) noexcept -> int
+{
+	int parsed = 0;
+	for (; parsed < count; ++parsed)
+	{
+		p = skip_spaces(p, end);
+		if (p >= end)
+			break;
+
+		char* next = nullptr;
+		values[parsed] = std::strtof(p, &next);
+		if (next == p)
+			break;
+		p = next;
+	}
+
+	return parsed;
+}
+
+// OBJ indices are one-based, negative indices count back from the last element
+static auto resolve_index(long index, std::size_t size) noexcept -> std::uint32_t
+{
+	if (index > 0 && static_cast<std::size_t>(index) <= size)
+		return index - 1;
+	if (index < 0 && static_cast<std::size_t>(-index) <= size)
+		return size + index;
+	return ~std::uint32_t(0);
+}
+
+namespace
+{
+
+struct ObjIndex
+{
+	std::uint32_t position;
+	std::uint32_t texcoord;
+	std::uint32_t normal;
+
+	auto operator==(const ObjIndex& other) const noexcept -> bool
+	{
+		return position == other.position && texcoord == other.texcoord && normal == other.normal;
+	}
+};
+
+struct ObjIndexHash
+{
+	auto operator()(const ObjIndex& index) const noexcept -> std::size_t
+	{
+		std::size_t hash = index.position;
+		hash = hash * 31 + index.texcoord;
+		hash = hash * 31 + index.normal;
+		return hash;
+	}
+};
+
+} // namespace
+
+auto load_obj(const std::string& path) -> ObjMesh
+{
+	const auto contents = read_file(path);
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texcoords;
+	std::vector<glm::vec3> normals;
+	std::unordered_map<ObjIndex, std::uint32_t, ObjIndexHash> unique;
+	std::vector<std::uint32_t> polygon;
+	ObjMesh mesh;
+
+	const char* cursor = contents.data();
+	const char* const contents_end = cursor + contents.size();
+	std::size_t line_number = 0;
+
+	auto invalid = [&]()
+	{
+		Logger::get().error({"Invalid OBJ data in {} on line {}"}, path, line_number);
+		throw MeshFileException();
+	};
+
+	while (cursor < contents_end)
+	{
+		++line_number;
+		auto end = static_cast<const char*>(std::memchr(cursor, '\n', contents_end - cursor));
+		if (end == nullptr)
+			end = contents_end;
+
+		auto p = skip_spaces(cursor, end);
+		auto keyword_end = p;
+		while (keyword_end < end && *keyword_end != ' ' && *keyword_end != '\t')
+			++keyword_end;
+		const auto keyword = std::string_view(p, keyword_end - p);
+		p = keyword_end;
+		cursor = end + 1;
+
+		float values[3] = {};
+		if (keyword == "v")
+		{
+			if (parse_floats(p, end, values, 3) != 3)
+				invalid();
+			positions.emplace_back(values[0], values[1], values[2]);
+		}
+		else if (keyword == "vt")
+		{
+			if (parse_floats(p, end, values, 2) < 1)
+				invalid();
+			texcoords.emplace_back(values[0], values[1]);
+		}
+		else if (keyword == "vn")
+		{
+			if (parse_floats(p, end, values, 3) != 3)
+				invalid();
+			normals.emplace_back(values[0], values[1], values[2]);
+		}
+		else if (keyword == "f")
+		{
+			polygon.clear();
+
+			while ((p = skip_spaces(p, end)) < end)
+			{
+				// v, v/vt, v//vn or v/vt/vn
+				long parts[3] = {0, 0, 0};
+				for (std::size_t part = 0; part < 3 && p < end; ++part)
+				{
+					char* next = nullptr;
+					if (*p != '/')
+					{
+						parts[part] = std::strtol(p, &next, 10);
+						if (next == p)
+							invalid();
+						p = next;
+					}
+
+					if (p >= end || *p != '/')
+						break;
+					++p;
+				}
+
+				ObjIndex index {
+					resolve_index(parts[0], positions.size()),
+					parts[1] ? resolve_index(parts[1], texcoords.size()) : ~std::uint32_t(0),
+					parts[2] ? resolve_index(parts[2], normals.size()) : ~std::uint32_t(0)};
+
+				if (index.position == ~std::uint32_t(0)
+					|| (parts[1] && index.texcoord == ~std::uint32_t(0))
+					|| (parts[2] && index.normal == ~std::uint32_t(0)))
+					invalid();
+
+				auto [it, inserted] = unique.try_emplace(index, mesh.vertices.size());
+				if (inserted)
+				{
+					mesh.vertices.emplace_back(positions[index.position],
+						parts[1] ? texcoords[index.texcoord] : glm::vec2(0.0f),
+						parts[2] ? normals[index.normal] : glm::vec3(0.0f));
+				}
+				polygon.push_back(it->second);
+			}
+
+			if (polygon.size() < 3)
+				invalid();
+
+			for (std::size_t i = 2; i < polygon.size(); ++i)
+				mesh.indices.insert(mesh.indices.end(), {polygon[0], polygon[i - 1], polygon[i]});
+		}
+	}
+
+	return mesh;
+}
+
+namespace
+{
+
+/*
+ * Payloads follow the header, each aligned to payload_alignment
+ */
+struct MeshFileHeader
+{
+	std::array<char, 4> magic;
+	std::uint32_t index_type;
+	std::uint64_t layout;
+	std::uint64_t vertex_size;
+	std::uint64_t vertex_count;
+	std::uint64_t index_count;
+	std::uint64_t vertex_offset;
+	std::uint64_t index_offset;
+};
+
+constexpr std::array<char, 4> mesh_file_magic = {'O', 'R', 'M', '1'};
+constexpr std::size_t payload_alignment = 16;
+
+// count * element_size <= available, without overflowing on corrupt headers
+static bool fits(std::uint64_t count, std::uint64_t element_size, std::uint64_t available) noexcept
+{
+	return element_size == 0 || count <= available / element_size;
+}
+
+} // namespace
+
+static auto align_payload(std::size_t offset) noexcept -> std::size_t
+{
+	return (offset + payload_alignment - 1) / payload_alignment * payload_alignment;
+}
+
+MeshFile::MeshFile(const std::string& path)
+{
+#if defined(_WIN32)
+	auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size {};
+	if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			data = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = file_size.QuadPart;
+		}
+	}
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	const int file = open(path.c_str(), O_RDONLY);
+	struct stat info {};
+	if (file >= 0 && fstat(file, &info) == 0 && info.st_size > 0)
+	{
+		void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view != MAP_FAILED)
+		{
+			data = static_cast<const std::byte*>(view);
+			size = info.st_size;
+		}
+	}
+	if (file >= 0)
+		close(file);
+#endif
+
+	if (data == nullptr)
+	{
+		unmap();
+		Logger::get().error({"Unable to map {}"}, path);
+		throw MeshFileException();
+	}
+
+	MeshFileHeader header {};
+	if (size >= sizeof(header))
+		std::memcpy(&header, data, sizeof(header));
+
+	const bool valid = size >= sizeof(header)
+		&& header.magic == mesh_file_magic
+		&& header.vertex_offset <= size
+		&& fits(header.vertex_count, header.vertex_size, size - header.vertex_offset)
+		&& header.index_offset <= size
+		&& (header.index_type == static_cast<std::uint32_t>(IndexType::u8)
+			|| header.index_type == static_cast<std::uint32_t>(IndexType::u16)
+			|| header.index_type == static_cast<std::uint32_t>(IndexType::u32))
+		&& fits(header.index_count, index_size(static_cast<IndexType>(header.index_type)), size - header.index_offset);
+
+	if (!valid)
+	{
+		unmap();
+		Logger::get().error({"{} is not a valid mesh file"}, path);
+		throw MeshFileException();
+	}
+}
+
+MeshFile::~MeshFile()
+{
+	unmap();
+}
+
+MeshFile::MeshFile(MeshFile&& other) noexcept
+: data(std::exchange(other.data, nullptr))
+, size(std::exchange(other.size, 0))
+, mapping(std::exchange(other.mapping, nullptr))
+{
+}
+
+auto MeshFile::operator=(MeshFile&& other) noexcept -> MeshFile&
+{
+	if (this != &other)
+	{
+		unmap();
+		data = std::exchange(other.data, nullptr);
+		size = std::exchange(other.size, 0);
+		mapping = std::exchange(other.mapping, nullptr);
+	}
+	return *this;
+}
+
+auto MeshFile::vertex_bytes() const noexcept -> gsl::span<const std::byte>
+{
+	const auto header = reinterpret_cast<const MeshFileHeader*>(data);
+	return {data + header->vertex_offset, header->vertex_count * header->vertex_size};
+}
+
+auto MeshFile::index_bytes() const noexcept -> gsl::span<const std::byte>
+{
+	const auto header = reinterpret_cast<const MeshFileHeader*>(data);
+	return {data + header->index_offset, header->index_count * index_size(index_type())};
+}
+
+auto MeshFile::layout() const noexcept -> std::uint64_t
+{
+	return reinterpret_cast<const MeshFileHeader*>(data)->layout;
+}
+
+auto MeshFile::index_type() const noexcept -> IndexType
+{
+	return static_cast<IndexType>(reinterpret_cast<const MeshFileHeader*>(data)->index_type);
+}
+
+auto MeshFile::vertex_count() const noexcept -> std::size_t
+{
+	return reinterpret_cast<const MeshFileHeader*>(data)->vertex_count;
+}
+
+auto MeshFile::index_count() const noexcept -> std::size_t
+{
+	return reinterpret_cast<const MeshFileHeader*>(data)->index_count;
+}
+
+void MeshFile::check_layout(std::uint64_t layout, std::size_t vertex_size) const
+{
+	const auto header = reinterpret_cast<const MeshFileHeader*>(data);
+	if (header->layout != layout || header->vertex_size != vertex_size)
+	{
+		Logger::get().error({"Mesh file vertex layout does not match the requested vertex type"});
+		throw MeshFileException();
+	}
+}
+
+void MeshFile::unmap() noexcept
+{
+#if defined(_WIN32)
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+#else
+	if (data)
+		munmap(const_cast<std::byte*>(data), size);
+#endif
+
+	data = nullptr;
+	size = 0;
+	mapping = nullptr;
+}
+
+void save_mesh(const std::string& path,
+		std::uint64_t layout,
+		std::size_t vertex_size,
+		gsl::span<const std::byte> vertices,
+		gsl::span<const std::byte> indices,
+		IndexType type)
+{
+	MeshFileHeader header {};
+	header.magic = mesh_file_magic;
+	header.index_type = static_cast<std::uint32_t>(type);
+	header.layout = layout;
+	header.vertex_size = vertex_size;
+	header.vertex_count = vertices.size() / vertex_size;
+	header.index_count = indices.size() / index_size(type);
+	header.vertex_offset = align_payload(sizeof(header));
+	header.index_offset = align_payload(header.vertex_offset + vertices.size());
+
+	// written beside the target and renamed over it, so a crash never leaves a partial
+	// file and existing mappings of the old file stay valid
+	const auto temporary = path + ".tmp";
+	auto file = std::fopen(temporary.c_str(), "wb");
+	if (file == nullptr)
+	{
+		Logger::get().error({"Unable to open {}"}, temporary);
+		throw MeshFileException();
+	}
+
+	const std::array<std::byte, payload_alignment> padding {};
+	auto write = [&](const void* bytes, std::size_t count)
+	{
+		return std::fwrite(bytes, 1, count, file) == count;
+	};
+
+	const bool written = write(&header, sizeof(header))
+		&& write(padding.data(), header.vertex_offset - sizeof(header))
+		&& write(vertices.data(), vertices.size())
+		&& write(padding.data(), header.index_offset - header.vertex_offset - vertices.size())
+		&& write(indices.data(), indices.size());
+
+	std::error_code error;
+	if (std::fclose(file) != 0 || !written)
+	{
+		std::filesystem::remove(temporary, error);
+		Logger::get().error({"Unable to write {}"}, temporary);
+		throw MeshFileException();
+	}
+
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+	{
+		std::filesystem::remove(temporary, error);
+		Logger::get().error({"Unable to replace {}"}, path);
+		throw MeshFileException();
+	}
+}
+
+auto load_obj_cached(const std::string& obj_path, const std::string& cache_path) -> MeshFile
+{
+	std::error_code obj_error, cache_error;
+	const auto obj_time = std::filesystem::last_write_time(obj_path, obj_error);
+	const auto cache_time = std::filesystem::last_write_time(cache_path, cache_error);
+
+	if (!cache_error && (obj_error || cache_time >= obj_time))
+	{
+		// a truncated cache or one written by another build is regenerated
+		try
+		{
+			MeshFile file(cache_path);
+			if (file.layout() == vertex_layout<ObjVertex>())
+				return file;
+
+			Logger::get().warn({"Mesh cache {} has another vertex layout, regenerating it"}, cache_path);
+		}
+		catch (const MeshFileException&)
+		{
+			if (obj_error)
+				throw;
+
+			Logger::get().warn({"Unable to map mesh cache {}, regenerating it"}, cache_path);
+		}
+	}
+
+	auto mesh = load_obj(obj_path);
+	optimize_mesh(mesh.vertices, mesh.indices);
+	save_mesh(cache_path, mesh.vertices, mesh.indices);
+
+	return MeshFile(cache_path);
+}
+
+} // namespace ori
@@ -0,0 +1,149 @@
+// mesh_io.hpp
+#ifndef MESH_IO_HPP_
+#define MESH_IO_HPP_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <gsl/span>
+
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+class MeshFileException : public std::runtime_error
+{
+public:
+	MeshFileException();
+};
+
+namespace detail
+{
+
+template <class T, std::size_t ... Is>
+auto vertex_layout(std::index_sequence<Is...>) noexcept -> std::uint64_t
+{
+	// FNV-1a over the size and every attribute format
+	std::uint64_t hash = 0xcbf29ce484222325;
+	auto mix = [&hash](std::uint64_t value)
+	{
+		hash = (hash ^ value) * 0x100000001b3;
+	};
+
+	mix(sizeof(T));
+	(void) swallow_t {(
+		mix(vertex_attribute<std::tuple_element_t<Is, T>>::type),
+		mix(vertex_attribute<std::tuple_element_t<Is, T>>::count),
+		mix(vertex_attribute<std::tuple_element_t<Is, T>>::normalized),
+		mix(vertex_attribute<std::tuple_element_t<Is, T>>::integer),
+		mix(tuple_element_offset<Is, T>()), 0)...};
+
+	return hash;
+}
+
+} // namespace detail
+
+/*
+ * Identifies the attribute layout of a vertex tuple, stored in mesh files
+ */
+template <class T>
+auto vertex_layout() noexcept -> std::uint64_t
+{
+	return detail::vertex_layout<T>(std::make_index_sequence<std::tuple_size_v<T>>());
+}
+
+// position, texcoord, normal
+using ObjVertex = std::tuple<glm::vec3, glm::vec2, glm::vec3>;
+
+struct ObjMesh
+{
+	std::vector<ObjVertex> vertices;
+	std::vector<std::uint32_t> indices;
+};
+
+/*
+ * Wavefront OBJ positions, texcoords, normals and faces, polygons are fanned
+ * Missing texcoords and normals are zero, throws MeshFileException
+ */
+auto load_obj(const std::string& path) -> ObjMesh;
+
+/*
+ * Memory-mapped binary mesh, vertices are stored exactly as Mesh<Ts...>
+ * expects them and indices already packed, so both upload without copies
+ */
+class MeshFile
+{
+public:
+	explicit MeshFile(const std::string& path);
+	~MeshFile();
+
+	MeshFile(MeshFile&& other) noexcept;
+	auto operator=(MeshFile&& other) noexcept -> MeshFile&;
+
+	MeshFile(const MeshFile&) = delete;
+	auto operator=(const MeshFile&) -> MeshFile& = delete;
+
+	// Throws MeshFileException if the file was written with another vertex layout
+	template <class T>
+	auto vertices() const -> gsl::span<const T>
+	{
+		check_layout(vertex_layout<T>(), sizeof(T));
+		return {reinterpret_cast<const T*>(vertex_bytes().data()), vertex_count()};
+	}
+
+	auto vertex_bytes() const noexcept -> gsl::span<const std::byte>;
+	auto index_bytes() const noexcept -> gsl::span<const std::byte>;
+
+	auto layout() const noexcept -> std::uint64_t;
+	auto index_type() const noexcept -> IndexType;
+	auto vertex_count() const noexcept -> std::size_t;
+	auto index_count() const noexcept -> std::size_t;
+
+private:
+	const std::byte* data = nullptr;
+	std::size_t size = 0;
+	void* mapping = nullptr;
+
+	void check_layout(std::uint64_t layout, std::size_t vertex_size) const;
+	void unmap() noexcept;
+};
+
+// Replaces path through a rename, MeshFiles mapping the old file are unaffected
+void save_mesh(const std::string& path,
+		std::uint64_t layout,
+		std::size_t vertex_size,
+		gsl::span<const std::byte> vertices,
+		gsl::span<const std::byte> indices,
+		IndexType type);
+
+// Indices are packed into the smallest type that fits
+template <class T>
+void save_mesh(const std::string& path, const std::vector<T>& vertices, const std::vector<std::uint32_t>& indices)
+{
+	const auto type = smallest_index_type(indices);
+	save_mesh(path,
+		vertex_layout<T>(),
+		sizeof(T),
+		gsl::as_bytes(gsl::span<const T>(vertices)),
+		pack_indices(indices, type),
+		type);
+}
+
+/*
+ * Map cache_path, first converting obj_path into it when the cache is missing, older,
+ * unreadable or written with another vertex layout
+ * Vertices are optimized for the vertex cache before they are written
+ */
+auto load_obj_cached(const std::string& obj_path, const std::string& cache_path) -> MeshFile;
+
+} // namespace ori
+
+#endif // MESH_IO_HPP_
@@ -0,0 +1,559 @@
+// mesh_processing.cpp
+#include "mesh_processing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+#include <glm/geometric.hpp>
+
+namespace ori
+{
+
+auto acmr(const std::vector<std::uint32_t>& indices, std::size_t cache_size) -> float
+{
+	if (indices.size() < 3)
+		return 0.0f;
+
+	const std::size_t vertex_count = *std::max_element(indices.begin(), indices.end()) + 1;
+
+	// FIFO cache, a vertex hits while fewer than cache_size misses happened since it entered
+	std::vector<std::size_t> entered(vertex_count, 0);
+	std::size_t misses = 0;
+
+	for (auto index : indices)
+	{
+		if (entered[index] == 0 || misses - entered[index] >= cache_size)
+		{
+			++misses;
+			entered[index] = misses;
+		}
+	}
+
+	return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Sander, Nehab, Barczak: Fast Triangle Reordering for Vertex Locality and Reduced Overdraw
+void optimize_vertex_cache(std::vector<std::uint32_t>& indices,
+		std::size_t vertex_count,
+		std::size_t cache_size)
+{
+	const std::size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0 || vertex_count == 0)
+		return;
+
+	// vertex to triangle adjacency
+	std::vector<std::uint32_t> live(vertex_count, 0);
+	for (auto index : indices)
+		++live[index];
+
+	std::vector<std::uint32_t> offsets(vertex_count + 1, 0);
+	for (std::size_t v = 0; v < vertex_count; ++v)
+		offsets[v + 1] = offsets[v] + live[v];
+
+	std::vector<std::uint32_t> adjacency(indices.size());
+	{
+		auto fill = offsets;
+		for (std::size_t i = 0; i < indices.size(); ++i)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<std::size_t> cache_time(vertex_count, 0);
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<std::uint32_t> dead_end;
+	std::vector<std::uint32_t> candidates;
+	std::vector<std::uint32_t> result;
+	result.reserve(indices.size());
+
+	std::size_t time = cache_size + 1;
+	std::size_t cursor = 1;
+	std::int64_t fan = 0;
+
+	auto skip_dead_end = [&]() -> std::int64_t
+	{
+		while (!dead_end.empty())
+		{
+			auto v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0)
+				return v;
+		}
+
+		for (; cursor < vertex_count; ++cursor)
+		{
+			if (live[cursor] > 0)
+				return cursor;
+		}
+
+		return -1;
+	};
+
+	while (fan >= 0)
+	{
+		candidates.clear();
+
+		for (auto t = offsets[fan]; t < offsets[fan + 1]; ++t)
+		{
+			auto triangle = adjacency[t];
+			if (emitted[triangle])
+				continue;
+
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				auto v = indices[triangle * 3 + k];
+				result.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+
+			emitted[triangle] = true;
+		}
+
+		// prefer candidates still in the cache that have live triangles left
+		std::int64_t best = -1;
+		std::int64_t best_priority = -1;
+		for (auto v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+
+			std::int64_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+				priority = time - cache_time[v];
+
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				best = v;
+			}
+		}
+
+		fan = best >= 0 ? best : skip_dead_end();
+	}
+
+	indices = std::move(result);
+}
+
+auto vertex_fetch_remap(std::vector<std::uint32_t>& indices, std::size_t vertex_count)
+-> std::vector<std::uint32_t>
+{
+	std::vector<std::uint32_t> remap(vertex_count, remap_unused);
+	std::uint32_t next = 0;
+
+	for (auto& index : indices)
+	{
+		if (remap[index] == remap_unused)
+			remap[index] = next++;
+		index = remap[index];
+	}
+
+	return remap;
+}
+
+auto duplicate_vertex_remap(gsl::span<const std::byte> vertices,
+		std::size_t vertex_size,
+		std::vector<std::uint32_t>& indices)
+-> std::vector<std::uint32_t>
+{
+	const std::size_t vertex_count = vertices.size() / vertex_size;
+
+	auto bytes = [&](std::size_t v)
+	{
+		return std::string_view(reinterpret_cast<const char*>(vertices.data()) + v * vertex_size, vertex_size);
+	};
+
+	std::unordered_map<std::string_view, std::uint32_t> unique;
+	unique.reserve(vertex_count);
+
+	std::vector<std::uint32_t> remap(vertex_count, remap_unused);
+	std::uint32_t next = 0;
+
+	for (std::size_t v = 0; v < vertex_count; ++v)
+	{
+		auto [it, inserted] = unique.try_emplace(bytes(v), next);
+		if (inserted)
+			++next;
+		remap[v] = it->second;
+	}
+
+	for (auto& index : indices)
+		index = remap[index];
+
+	return remap;
+}
+
+namespace
+{
+
+// Symmetric 4x4 plane quadric, error is normalized by the accumulated weight
+struct Quadric
+{
+	double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+	double b2 = 0.0, bc = 0.0, bd = 0.0;
+	double c2 = 0.0, cd = 0.0;
+	double d2 = 0.0;
+	double weight = 0.0;
+
+	static auto plane(glm::vec3 normal, glm::vec3 point, double weight) noexcept -> Quadric
+	{
+		const double a = normal.x, b = normal.y, c = normal.z;
+		const double d = -glm::dot(normal, point);
+		return {a * a * weight, a * b * weight, a * c * weight, a * d * weight,
+			b * b * weight, b * c * weight, b * d * weight,
+			c * c * weight, c * d * weight,
+			d * d * weight,
+			weight};
+	}
+
+	auto operator+=(const Quadric& q) noexcept -> Quadric&
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		weight += q.weight;
+		return *this;
+	}
+
+	auto error(glm::vec3 p) const noexcept -> double
+	{
+		const double x = p.x, y = p.y, z = p.z;
+		const double e = a2 * x * x + b2 * y * y + c2 * z * z + d2
+			+ 2.0 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+		return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+	}
+};
+
+// Boundary edges are held in place by planes perpendicular to their triangle
+constexpr float boundary_weight = 10.0f;
+
+struct Collapse
+{
+	std::uint32_t from;
+	std::uint32_t to;
+	double cost;
+};
+
+class Simplifier
+{
+public:
+	Simplifier(const std::vector<std::uint32_t>& __indices, gsl::span<const glm::vec3> __positions) :
+		indices(__indices),
+		positions(__positions),
+		quadrics(__positions.size()),
+		locked(__positions.size(), false)
+	{
+		lock_seams();
+		accumulate_quadrics();
+	}
+
+	// Collapse edges until at most target_index_count indices remain or no collapse is possible
+	void collapse_to(std::size_t target_index_count)
+	{
+		while (indices.size() > target_index_count)
+		{
+			if (!collapse_pass(indices.size() - target_index_count))
+				break;
+		}
+	}
+
+	auto result() const noexcept -> const std::vector<std::uint32_t>&
+	{
+		return indices;
+	}
+
+	auto error() const noexcept -> float
+	{
+		return _error;
+	}
+
+private:
+	std::vector<std::uint32_t> indices;
+	gsl::span<const glm::vec3> positions;
+	std::vector<Quadric> quadrics;
+	std::vector<bool> locked;
+	float _error = 0.0f;
+
+	// vertex to triangle adjacency of the current indices
+	std::vector<std::uint32_t> offsets;
+	std::vector<std::uint32_t> adjacency;
+
+	void lock_seams()
+	{
+		auto bytes = [&](std::size_t v)
+		{
+			return std::string_view(reinterpret_cast<const char*>(&positions[v]), sizeof(glm::vec3));
+		};
+
+		std::unordered_map<std::string_view, std::uint32_t> first;
+		first.reserve(positions.size());
+
+		for (std::size_t v = 0; v < positions.size(); ++v)
+		{
+			auto [it, inserted] = first.try_emplace(bytes(v), v);
+			if (!inserted)
+				locked[v] = locked[it->second] = true;
+		}
+	}
+
+	void accumulate_quadrics()
+	{
+		auto edge_key = [](std::uint64_t a, std::uint64_t b)
+		{
+			return a < b ? (a << 32 | b) : (b << 32 | a);
+		};
+
+		std::unordered_map<std::uint64_t, std::uint32_t> edges;
+		edges.reserve(indices.size());
+		for (std::size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (std::size_t k = 0; k < 3; ++k)
+				++edges[edge_key(indices[i + k], indices[i + (k + 1) % 3])];
+		}
+
+		for (std::size_t i = 0; i < indices.size(); i += 3)
+		{
+			const glm::vec3 p0 = positions[indices[i]];
+			const glm::vec3 p1 = positions[indices[i + 1]];
+			const glm::vec3 p2 = positions[indices[i + 2]];
+
+			const auto normal = glm::cross(p1 - p0, p2 - p0);
+			const float area = glm::length(normal);
+			if (area == 0.0f)
+				continue;
+
+			const auto unit = normal / area;
+			const auto face = Quadric::plane(unit, p0, area * 0.5f);
+			for (std::size_t k = 0; k < 3; ++k)
+				quadrics[indices[i + k]] += face;
+
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				const auto a = indices[i + k];
+				const auto b = indices[i + (k + 1) % 3];
+				if (edges[edge_key(a, b)] != 1)
+					continue;
+
+				const auto edge = positions[b] - positions[a];
+				const float length = glm::length(edge);
+				if (length == 0.0f)
+					continue;
+
+				const auto border = Quadric::plane(glm::cross(edge / length, unit), positions[a],
+					length * length * boundary_weight);
+				quadrics[a] += border;
+				quadrics[b] += border;
+			}
+		}
+	}
+
+	void build_adjacency()
+	{
+		offsets.assign(positions.size() + 1, 0);
+		for (auto index : indices)
+			++offsets[index + 1];
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+		adjacency.resize(indices.size());
+		auto fill = offsets;
+		for (std::size_t i = 0; i < indices.size(); ++i)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	// Triangles removed by moving from onto to, or zero when a remaining triangle flips
+	auto removed_triangles(std::uint32_t from, std::uint32_t to) const -> std::size_t
+	{
+		std::size_t removed = 0;
+
+		for (auto t = offsets[from]; t < offsets[from + 1]; ++t)
+		{
+			const auto* triangle = &indices[adjacency[t] * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				++removed;
+				continue;
+			}
+
+			glm::vec3 p[3];
+			for (std::size_t k = 0; k < 3; ++k)
+				p[k] = positions[triangle[k]];
+			const auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				if (triangle[k] == from)
+					p[k] = positions[to];
+			}
+			const auto after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+			if (glm::dot(before, after) <= 0.0f)
+				return 0;
+		}
+
+		return removed;
+	}
+
+	// Apply the cheapest independent collapses, returns false when none could be applied
+	auto collapse_pass(std::size_t excess_indices) -> bool
+	{
+		build_adjacency();
+
+		std::vector<Collapse> collapses;
+		collapses.reserve(indices.size() * 2);
+		for (std::size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				const auto a = indices[i + k];
+				const auto b = indices[i + (k + 1) % 3];
+				for (auto [from, to] : {std::pair(a, b), std::pair(b, a)})
+				{
+					if (locked[from])
+						continue;
+
+					auto q = quadrics[from];
+					q += quadrics[to];
+					collapses.push_back({from, to, q.error(positions[to])});
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const auto& a, const auto& b)
+		{
+			return a.cost < b.cost;
+		});
+
+		std::vector<std::uint32_t> remap(positions.size());
+		std::iota(remap.begin(), remap.end(), 0);
+		std::vector<bool> touched(positions.size(), false);
+		std::size_t removed = 0;
+
+		for (const auto& collapse : collapses)
+		{
+			if (removed * 3 >= excess_indices)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			const auto triangles = removed_triangles(collapse.from, collapse.to);
+			if (triangles == 0)
+				continue;
+
+			// every vertex of the changed triangles waits for the next pass
+			for (auto t = offsets[collapse.from]; t < offsets[collapse.from + 1]; ++t)
+			{
+				for (std::size_t k = 0; k < 3; ++k)
+					touched[indices[adjacency[t] * 3 + k]] = true;
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			_error = std::max(_error, static_cast<float>(std::sqrt(collapse.cost)));
+			removed += triangles;
+		}
+
+		if (removed == 0)
+			return false;
+
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < indices.size(); i += 3)
+		{
+			const auto a = remap[indices[i]];
+			const auto b = remap[indices[i + 1]];
+			const auto c = remap[indices[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+
+		return true;
+	}
+};
+
+} // namespace
+
+auto simplify(const std::vector<std::uint32_t>& indices,
+		gsl::span<const glm::vec3> positions,
+		std::size_t target_index_count,
+		float* error)
+-> std::vector<std::uint32_t>
+{
+	Simplifier simplifier(indices, positions);
+	simplifier.collapse_to(target_index_count);
+
+	if (error)
+		*error = simplifier.error();
+	return simplifier.result();
+}
+
+auto generate_lods(const std::vector<std::uint32_t>& indices,
+		gsl::span<const glm::vec3> positions,
+		std::size_t levels,
+		float ratio)
+-> LodChain
+{
+	LodChain chain;
+	chain.indices = indices;
+	chain.levels.push_back({{0, 0, indices.size()}, 0.0f});
+
+	// quadrics carry over so each level's error is measured against the full mesh
+	Simplifier simplifier(indices, positions);
+	std::size_t previous = indices.size();
+
+	for (std::size_t level = 1; level < levels; ++level)
+	{
+		simplifier.collapse_to(static_cast<std::size_t>(previous * ratio) / 3 * 3);
+		if (simplifier.result().size() >= previous)
+			break;
+
+		auto lod = simplifier.result();
+		optimize_vertex_cache(lod, positions.size());
+		previous = lod.size();
+
+		chain.levels.push_back({{0, chain.indices.size(), lod.size()}, simplifier.error()});
+		chain.indices.insert(chain.indices.end(), lod.begin(), lod.end());
+	}
+
+	return chain;
+}
+
+auto lod_projection_scale(float fov_y, float viewport_height) noexcept -> float
+{
+	return viewport_height / (2.0f * std::tan(fov_y * 0.5f));
+}
+
+auto select_lod(gsl::span<const MeshLod> levels,
+		float distance,
+		float projection_scale,
+		float max_pixel_error) noexcept
+-> std::size_t
+{
+	const float scale = projection_scale / std::max(distance, std::numeric_limits<float>::min());
+
+	std::size_t selected = 0;
+	for (std::size_t i = 0; i < levels.size(); ++i)
+	{
+		if (levels[i].error * scale <= max_pixel_error)
+			selected = i;
+	}
+
+	return selected;
+}
+
+auto lod_range(const MeshLod& lod, const MeshRange& mesh) noexcept -> MeshRange
+{
+	return {mesh.base_vertex, mesh.first_index + lod.range.first_index, lod.range.count};
+}
+
+} // namespace ori
@@ -0,0 +1,181 @@
+// mesh_processing.hpp
+#ifndef MESH_PROCESSING_HPP_
+#define MESH_PROCESSING_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include <gsl/span>
+
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+/*
+ * Before and after figures of optimize_mesh
+ */
+struct MeshOptimizationStats
+{
+	float acmr_before = 0.0f;
+	float acmr_after = 0.0f;
+	std::size_t vertices_before = 0;
+	std::size_t vertices_after = 0;
+};
+
+// Average cache miss ratio, transformed vertices per triangle with a FIFO cache
+auto acmr(const std::vector<std::uint32_t>& indices, std::size_t cache_size = 16) -> float;
+
+// Reorder triangles for post-transform cache locality (Tipsify)
+void optimize_vertex_cache(std::vector<std::uint32_t>& indices,
+		std::size_t vertex_count,
+		std::size_t cache_size = 16);
+
+/*
+ * Remap tables map an old vertex index to its new index
+ * Unreferenced vertices map to remap_unused
+ */
+constexpr std::uint32_t remap_unused = ~std::uint32_t(0);
+
+// Number vertices in order of first use, rewriting indices
+auto vertex_fetch_remap(std::vector<std::uint32_t>& indices, std::size_t vertex_count)
+-> std::vector<std::uint32_t>;
+
+// Map bytewise identical vertices to a single index, rewriting indices
+auto duplicate_vertex_remap(gsl::span<const std::byte> vertices,
+		std::size_t vertex_size,
+		std::vector<std::uint32_t>& indices)
+-> std::vector<std::uint32_t>;
+
+template <class T>
+void apply_vertex_remap(std::vector<T>& vertices, const std::vector<std::uint32_t>& remap)
+{
+	std::size_t count = 0;
+	for (auto index : remap)
+	{
+		if (index != remap_unused)
+			count = std::max<std::size_t>(count, index + 1);
+	}
+
+	std::vector<T> remapped(count);
+	for (std::size_t i = 0; i < remap.size(); ++i)
+	{
+		if (remap[i] != remap_unused)
+			remapped[remap[i]] = vertices[i];
+	}
+
+	vertices = std::move(remapped);
+}
+
+/*
+ * Remove duplicate vertices, compared bytewise
+ * Vertex types with padding may leave some duplicates behind
+ */
+template <class T>
+void deduplicate_vertices(std::vector<T>& vertices, std::vector<std::uint32_t>& indices)
+{
+	auto bytes = gsl::as_bytes(gsl::span<const T>(vertices));
+	apply_vertex_remap(vertices, duplicate_vertex_remap(bytes, sizeof(T), indices));
+}
+
+// Reorder vertices in order of first use and drop unreferenced ones
+template <class T>
+void optimize_vertex_fetch(std::vector<T>& vertices, std::vector<std::uint32_t>& indices)
+{
+	apply_vertex_remap(vertices, vertex_fetch_remap(indices, vertices.size()));
+}
+
+/*
+ * Deduplicate, then reorder triangles for the vertex cache, then reorder
+ * vertices for fetch locality, run before building the Mesh or when cooking assets
+ */
+template <class T>
+auto optimize_mesh(std::vector<T>& vertices,
+		std::vector<std::uint32_t>& indices,
+		std::size_t cache_size = 16)
+-> MeshOptimizationStats
+{
+	MeshOptimizationStats stats;
+	stats.acmr_before = acmr(indices, cache_size);
+	stats.vertices_before = vertices.size();
+
+	deduplicate_vertices(vertices, indices);
+	optimize_vertex_cache(indices, vertices.size(), cache_size);
+	optimize_vertex_fetch(vertices, indices);
+
+	stats.acmr_after = acmr(indices, cache_size);
+	stats.vertices_after = vertices.size();
+	return stats;
+}
+
+/*
+ * A level of detail, range is relative to the start of LodChain::indices
+ * Error is the approximate deviation from the full mesh in object space units
+ */
+struct MeshLod
+{
+	MeshRange range;
+	float error = 0.0f;
+};
+
+/*
+ * Index ranges of every level share one vertex buffer, level 0 is the full mesh
+ */
+struct LodChain
+{
+	std::vector<std::uint32_t> indices;
+	std::vector<MeshLod> levels;
+};
+
+/*
+ * Quadric edge collapse towards target_index_count, vertices are only ever
+ * collapsed onto each other so the simplified indices reuse the same vertex buffer
+ * Vertices on attribute seams are locked to avoid cracks, the error is written to error
+ */
+auto simplify(const std::vector<std::uint32_t>& indices,
+		gsl::span<const glm::vec3> positions,
+		std::size_t target_index_count,
+		float* error = nullptr)
+-> std::vector<std::uint32_t>;
+
+// Each level keeps ratio of the previous level's triangles, stops early once collapses run out
+auto generate_lods(const std::vector<std::uint32_t>& indices,
+		gsl::span<const glm::vec3> positions,
+		std::size_t levels = 4,
+		float ratio = 0.5f)
+-> LodChain;
+
+// First tuple element of every vertex
+template <class T>
+auto vertex_positions(const std::vector<T>& vertices) -> std::vector<glm::vec3>
+{
+	std::vector<glm::vec3> positions;
+	positions.reserve(vertices.size());
+	for (const auto& vertex : vertices)
+		positions.push_back(glm::vec3(std::get<0>(vertex)));
+	return positions;
+}
+
+// Pixels covered by one object space unit at distance one
+auto lod_projection_scale(float fov_y, float viewport_height) noexcept -> float;
+
+/*
+ * Coarsest level whose error projects to at most max_pixel_error pixels
+ * at distance, with projection_scale from lod_projection_scale
+ */
+auto select_lod(gsl::span<const MeshLod> levels,
+		float distance,
+		float projection_scale,
+		float max_pixel_error = 1.0f) noexcept
+-> std::size_t;
+
+// Offset a level into a mesh, e.g. the range of a PooledMesh
+auto lod_range(const MeshLod& lod, const MeshRange& mesh = {}) noexcept -> MeshRange;
+
+} // namespace ori
+
+#endif // MESH_PROCESSING_HPP_
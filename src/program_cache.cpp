@@ -0,0 +1,244 @@
+// program_cache.cpp
+#include "program_cache.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include <glad/glad.h>
+
+#include "Logger.hpp"
+
+namespace ori
+{
+
+namespace
+{
+
+struct ProgramCacheHeader
+{
+	std::array<char, 4> magic;
+	std::uint32_t format;
+	std::uint64_t key;
+	std::uint64_t size;
+};
+
+constexpr std::array<char, 4> program_cache_magic = {'O', 'R', 'P', 'B'};
+
+
+} // namespace
+
+void Fnv1a::add(std::uint64_t value) noexcept
+{
+	for (std::size_t i = 0; i < sizeof(value); ++i)
+		add_byte(value >> (i * 8));
+}
+
+void Fnv1a::add(std::string_view text) noexcept
+{
+	add(text.size());
+	for (char c : text)
+		add_byte(c);
+}
+
+auto Fnv1a::value() const noexcept -> std::uint64_t
+{
+	return hash;
+}
+
+void Fnv1a::add_byte(unsigned char byte) noexcept
+{
+	hash = (hash ^ byte) * 0x100000001b3;
+}
+
+static auto gl_string(GLenum name) -> std::string
+{
+	auto str = glGetString(name);
+	return str ? std::string((const char*) str) : std::string();
+}
+
+// Larger sizes in a header can only come from a corrupt file
+constexpr std::uint64_t max_binary_size = 256 * 1024 * 1024;
+
+static auto read_binary(const std::string& path, std::uint64_t key) -> std::optional<ProgramBinary>
+{
+	std::error_code error;
+	const auto file_size = std::filesystem::file_size(path, error);
+	if (error || file_size < sizeof(ProgramCacheHeader))
+		return std::nullopt;
+
+	auto file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return std::nullopt;
+
+	// truncated or corrupt files are misses, the program is rebuilt and rewritten
+	ProgramCacheHeader header {};
+	std::optional<ProgramBinary> binary;
+	if (std::fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == program_cache_magic
+		&& header.key == key
+		&& header.size <= max_binary_size
+		&& header.size == file_size - sizeof(header))
+	{
+		binary.emplace();
+		binary->format = header.format;
+		binary->data.resize(header.size);
+		if (std::fread(binary->data.data(), 1, header.size, file) != header.size)
+			binary.reset();
+	}
+
+	std::fclose(file);
+	return binary;
+}
+
+auto inject_defines(std::string_view source, const std::vector<std::string>& defines) -> std::string
+{
+	std::string lines;
+	for (const auto& define : defines)
+		lines += "#define " + define + "\n";
+
+	// defines must follow #version, which may come after comments
+	std::size_t insert = 0;
+	for (std::size_t line = 0; line < source.size();)
+	{
+		auto end = source.find('\n', line);
+		end = end == std::string_view::npos ? source.size() : end + 1;
+
+		const auto text = source.substr(line, end - line);
+		const auto first = text.find_first_not_of(" \t");
+		if (first != std::string_view::npos && text.substr(first, 8) == "#version")
+		{
+			insert = end;
+			break;
+		}
+		line = end;
+	}
+
+	std::string result(source.substr(0, insert));
+	if (insert > 0 && result.back() != '\n')
+		result += '\n';
+	result += lines;
+	result += source.substr(insert);
+	return result;
+}
+
+ProgramCache::ProgramCache(std::string __directory)
+: directory(std::move(__directory))
+, driver(gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION))
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+		Logger::get().warn({"Unable to create program cache {}: {}"}, directory, error.message());
+}
+
+auto ProgramCache::load(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines)
+-> ShaderProgram
+{
+	if (auto program = find(sources, defines))
+		return std::move(*program);
+
+	std::vector<Shader> shaders;
+	for (const auto& source : sources)
+		shaders.push_back(compile({source.stage, inject_defines(source.source, defines)}));
+
+	ShaderProgram program(ShaderVec(std::move(shaders)), true);
+	store(sources, defines, program);
+	return program;
+}
+
+auto ProgramCache::find(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines)
+-> std::optional<ShaderProgram>
+{
+	const auto program_key = key(sources, defines);
+	const auto program_path = path(program_key);
+
+	if (auto binary = read_binary(program_path, program_key))
+	{
+		try
+		{
+			ShaderProgram program(*binary);
+			++_hits;
+			return program;
+		}
+		catch (const ShaderException&)
+		{
+			Logger::get().warn({"Ignoring rejected program binary {}"}, program_path);
+		}
+	}
+
+	++_misses;
+	return std::nullopt;
+}
+
+void ProgramCache::store(const std::vector<ShaderSource>& sources,
+		const std::vector<std::string>& defines,
+		const ShaderProgram& program) const
+{
+	write(key(sources, defines), program.binary());
+}
+
+auto ProgramCache::key(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines) const
+-> std::uint64_t
+{
+	Fnv1a hasher;
+	hasher.add(driver);
+
+	hasher.add(sources.size());
+	for (const auto& source : sources)
+	{
+		hasher.add(static_cast<std::uint64_t>(source.stage));
+		hasher.add(source.source);
+	}
+
+	hasher.add(defines.size());
+	for (const auto& define : defines)
+		hasher.add(define);
+
+	return hasher.value();
+}
+
+auto ProgramCache::hits() const noexcept -> std::size_t
+{
+	return _hits;
+}
+
+auto ProgramCache::misses() const noexcept -> std::size_t
+{
+	return _misses;
+}
+
+auto ProgramCache::path(std::uint64_t key) const -> std::string
+{
+	std::array<char, 17> name;
+	std::snprintf(name.data(), name.size(), "%016llx", static_cast<unsigned long long>(key));
+	return (std::filesystem::path(directory) / (std::string(name.data()) + ".bin")).string();
+}
+
+// A failed write only costs a recompile next time, so it is not an error
+void ProgramCache::write(std::uint64_t key, const ProgramBinary& binary) const
+{
+	if (binary.data.empty())
+		return;
+
+	const auto program_path = path(key);
+	auto file = std::fopen(program_path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		Logger::get().warn({"Unable to write program binary {}"}, program_path);
+		return;
+	}
+
+	ProgramCacheHeader header {program_cache_magic, binary.format, key, binary.data.size()};
+	const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+		&& std::fwrite(binary.data.data(), 1, binary.data.size(), file) == binary.data.size();
+
+	if (std::fclose(file) != 0 || !written)
+	{
+		Logger::get().warn({"Unable to write program binary {}"}, program_path);
+		std::remove(program_path.c_str());
+	}
+}
+
+} // namespace ori
@@ -0,0 +1,80 @@
+// program_cache.hpp
+#ifndef PROGRAM_CACHE_HPP_
+#define PROGRAM_CACHE_HPP_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+/*
+ * FNV-1a, strings are length prefixed so concatenations can't collide
+ */
+class Fnv1a
+{
+public:
+	void add(std::uint64_t value) noexcept;
+	void add(std::string_view text) noexcept;
+
+	auto value() const noexcept -> std::uint64_t;
+
+private:
+	std::uint64_t hash = 0xcbf29ce484222325;
+
+	void add_byte(unsigned char byte) noexcept;
+};
+
+/*
+ * On-disk cache of linked program binaries
+ *
+ * Programs are keyed by a hash of their sources, defines and the driver's
+ * vendor, renderer and version. Binaries the driver rejects, e.g. after a
+ * driver update that kept its version string, are rebuilt from source and
+ * overwritten. Requires a current context.
+ */
+class ProgramCache
+{
+public:
+	explicit ProgramCache(std::string directory);
+
+	// Defines are NAME or NAME VALUE, injected after the #version line of every stage
+	auto load(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines = {})
+	-> ShaderProgram;
+
+	// The cached program, or nothing when it is missing or rejected
+	auto find(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines = {})
+	-> std::optional<ShaderProgram>;
+
+	// Write the binary of a program linked from sources, best linked as retrievable
+	void store(const std::vector<ShaderSource>& sources,
+			const std::vector<std::string>& defines,
+			const ShaderProgram& program) const;
+
+	auto key(const std::vector<ShaderSource>& sources, const std::vector<std::string>& defines = {}) const
+	-> std::uint64_t;
+
+	auto hits() const noexcept -> std::size_t;
+	auto misses() const noexcept -> std::size_t;
+
+private:
+	std::string directory;
+	std::string driver;
+	std::size_t _hits = 0;
+	std::size_t _misses = 0;
+
+	auto path(std::uint64_t key) const -> std::string;
+	void write(std::uint64_t key, const ProgramBinary& binary) const;
+};
+
+// Insert #define lines after the #version line, or at the start without one
+auto inject_defines(std::string_view source, const std::vector<std::string>& defines) -> std::string;
+
+} // namespace ori
+
+#endif // PROGRAM_CACHE_HPP_
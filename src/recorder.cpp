@@ -0,0 +1,322 @@
+// recorder.cpp
+#include "recorder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "Logger.hpp"
+
+#if __GNUC__
+#	pragma GCC diagnostic push
+#	pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#	pragma GCC diagnostic ignored "-Wsign-compare"
+#	pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#if __GNUC__
+#	pragma GCC diagnostic pop
+#endif
+
+namespace ori
+{
+
+static constexpr std::size_t components = 3;
+
+RecorderException::RecorderException()
+: std::runtime_error("Recorder exception")
+{
+}
+
+static void flip_rows(std::vector<unsigned char>& pixels, std::size_t row_size)
+{
+	const std::size_t rows = pixels.size() / row_size;
+	for (std::size_t i = 0; i < rows / 2; ++i)
+	{
+		std::swap_ranges(pixels.begin() + i * row_size,
+				pixels.begin() + (i + 1) * row_size,
+				pixels.begin() + (rows - 1 - i) * row_size);
+	}
+}
+
+// https://qoiformat.org/qoi-specification.pdf
+static auto encode_qoi(const std::vector<unsigned char>& pixels, std::size_t width, std::size_t height)
+-> std::vector<unsigned char>
+{
+	std::vector<unsigned char> out;
+	out.reserve(14 + pixels.size() + pixels.size() / components + 8);
+
+	auto put_u32 = [&out](std::uint32_t v)
+	{
+		out.push_back(v >> 24);
+		out.push_back(v >> 16);
+		out.push_back(v >> 8);
+		out.push_back(v);
+	};
+
+	out.insert(out.end(), {'q', 'o', 'i', 'f'});
+	put_u32(width);
+	put_u32(height);
+	out.push_back(components);
+	out.push_back(0);
+
+	using Pixel = std::array<unsigned char, 4>;
+	std::array<Pixel, 64> index = {};
+	Pixel prev = {0, 0, 0, 255};
+	int run = 0;
+
+	const std::size_t count = width * height;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const unsigned char* p = &pixels[i * components];
+		Pixel px = {p[0], p[1], p[2], 255};
+
+		if (px == prev)
+		{
+			++run;
+			if (run == 62 || i + 1 == count)
+			{
+				out.push_back(0xc0 | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run > 0)
+		{
+			out.push_back(0xc0 | (run - 1));
+			run = 0;
+		}
+
+		const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+		if (index[hash] == px)
+		{
+			out.push_back(hash);
+		}
+		else
+		{
+			index[hash] = px;
+
+			const int vr = static_cast<signed char>(px[0] - prev[0]);
+			const int vg = static_cast<signed char>(px[1] - prev[1]);
+			const int vb = static_cast<signed char>(px[2] - prev[2]);
+			const int vg_r = vr - vg;
+			const int vg_b = vb - vg;
+
+			if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+			{
+				out.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+			}
+			else if (vg >= -32 && vg <= 31 && vg_r >= -8 && vg_r <= 7 && vg_b >= -8 && vg_b <= 7)
+			{
+				out.push_back(0x80 | (vg + 32));
+				out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+			}
+			else
+			{
+				out.insert(out.end(), {0xfe, px[0], px[1], px[2]});
+			}
+		}
+
+		prev = px;
+	}
+
+	out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+	return out;
+}
+
+// BT.601 limited range, full resolution chroma (C444)
+static auto convert_y4m(const std::vector<unsigned char>& pixels) -> std::vector<unsigned char>
+{
+	const std::size_t count = pixels.size() / components;
+	std::vector<unsigned char> planes(count * 3);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const int r = pixels[i * components];
+		const int g = pixels[i * components + 1];
+		const int b = pixels[i * components + 2];
+		planes[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		planes[count + i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		planes[count * 2 + i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+
+	return planes;
+}
+
+Recorder::Recorder(std::string_view __path,
+		RecordFormat __format,
+		std::size_t __width,
+		std::size_t __height,
+		int frames_per_second,
+		std::size_t worker_count)
+: path(__path)
+, format(__format)
+, width(__width)
+, height(__height)
+, fps(frames_per_second)
+, readback(__width * __height * components * 4)
+{
+	if (format == RecordFormat::y4m)
+	{
+		stream = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+		if (stream == nullptr)
+		{
+			Logger::get().error({"Unable to open {}"}, path);
+			throw RecorderException();
+		}
+
+		std::fprintf(stream, "YUV4MPEG2 W%zu H%zu F%d:1 Ip A1:1 C444\n", width, height, fps);
+	}
+
+	worker_count = std::max<std::size_t>(worker_count, 1);
+	for (std::size_t i = 0; i < worker_count; ++i)
+		workers.emplace_back(&Recorder::work, this);
+}
+
+Recorder::~Recorder()
+{
+	finish();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_added.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+
+	if (stream && stream != stdout)
+		std::fclose(stream);
+	else if (stream)
+		std::fflush(stream);
+}
+
+void Recorder::capture()
+{
+	auto region = iRect2D({0, 0}, width, height);
+	readback.read(region, ImageFormat::rgb, [this, index = captured](gsl::span<const std::byte> data)
+	{
+		auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+		enqueue({index, std::vector<unsigned char>(bytes, bytes + data.size())});
+	});
+	++captured;
+}
+
+void Recorder::poll()
+{
+	readback.poll();
+}
+
+void Recorder::finish()
+{
+	readback.finish();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job_done.wait(lock, [this] { return written == captured; });
+
+	if (failed)
+	{
+		Logger::get().error({"Recorder failed to write {:d} frames to {}"}, failed, path);
+		failed = 0;
+	}
+}
+
+auto Recorder::frames() const noexcept -> std::size_t
+{
+	return captured;
+}
+
+auto Recorder::frames_per_second() const noexcept -> int
+{
+	return fps;
+}
+
+void Recorder::enqueue(Job&& job)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// bound memory use, the render thread waits for the encoders
+	job_done.wait(lock, [this] { return jobs.size() < workers.size() * 2; });
+	jobs.push_back(std::move(job));
+	lock.unlock();
+
+	job_added.notify_one();
+}
+
+void Recorder::work()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		job_added.wait(lock, [this] { return stopping || !jobs.empty(); });
+		if (jobs.empty())
+			return;
+
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		lock.unlock();
+		job_done.notify_all();
+
+		encode(job);
+	}
+}
+
+void Recorder::encode(Job& job)
+{
+	// glReadPixels returns rows bottom to top
+	flip_rows(job.pixels, width * components);
+
+	bool ok = true;
+
+	switch (format)
+	{
+	case RecordFormat::png:
+	{
+		auto filename = fmt::format("{}{:06d}.png", path, job.index);
+		ok = stbi_write_png(filename.c_str(), width, height, components, job.pixels.data(), width * components);
+		break;
+	}
+	case RecordFormat::qoi:
+	{
+		auto filename = fmt::format("{}{:06d}.qoi", path, job.index);
+		auto encoded = encode_qoi(job.pixels, width, height);
+		auto file = std::fopen(filename.c_str(), "wb");
+		ok = file && std::fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+		if (file)
+			std::fclose(file);
+		break;
+	}
+	case RecordFormat::y4m:
+		job.pixels = convert_y4m(job.pixels);
+		write_y4m(job);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	failed += !ok;
+	++written;
+	job_done.notify_all();
+}
+
+void Recorder::write_y4m(const Job& job)
+{
+	// frames of a stream must be written in order
+	std::unique_lock<std::mutex> lock(mutex);
+	job_done.wait(lock, [this, &job] { return written == job.index; });
+	lock.unlock();
+
+	bool ok = std::fputs("FRAME\n", stream) >= 0
+		&& std::fwrite(job.pixels.data(), 1, job.pixels.size(), stream) == job.pixels.size();
+
+	lock.lock();
+	failed += !ok;
+	++written;
+	job_done.notify_all();
+}
+
+} // namespace ori
@@ -0,0 +1,99 @@
+// recorder.hpp
+#ifndef RECORDER_HPP_
+#define RECORDER_HPP_
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+/*
+ * Output formats of a Recorder
+ */
+enum class RecordFormat
+{
+	png, // one file per frame
+	qoi, // one file per frame
+	y4m, // single stream, "-" writes to stdout
+};
+
+class RecorderException : public std::runtime_error
+{
+public:
+	RecorderException();
+};
+
+/*
+ * Captures the default framebuffer every frame and encodes it on a worker pool
+ * Pixels come back through a Readback ring, so the render thread never stalls
+ * on the gpu and never encodes
+ */
+class Recorder
+{
+public:
+	Recorder(std::string_view path,
+			RecordFormat format,
+			std::size_t width,
+			std::size_t height,
+			int frames_per_second,
+			std::size_t workers = std::thread::hardware_concurrency());
+	Recorder(const Recorder& other) = delete;
+	Recorder& operator=(const Recorder& other) = delete;
+	~Recorder();
+
+	// Queue a readback of the current back buffer
+	void capture();
+
+	// Hand finished readbacks to the workers, call once per frame
+	void poll();
+
+	// Block until every captured frame has been written
+	void finish();
+
+	auto frames() const noexcept -> std::size_t;
+	auto frames_per_second() const noexcept -> int;
+
+private:
+	struct Job
+	{
+		std::size_t index;
+		std::vector<unsigned char> pixels;
+	};
+
+	std::string path;
+	RecordFormat format;
+	std::size_t width;
+	std::size_t height;
+	int fps;
+	std::size_t captured = 0;
+	std::size_t written = 0;
+	std::size_t failed = 0;
+	Readback readback;
+	std::FILE* stream = nullptr;
+
+	std::vector<std::thread> workers;
+	std::deque<Job> jobs;
+	std::mutex mutex;
+	std::condition_variable job_added;
+	std::condition_variable job_done;
+	bool stopping = false;
+
+	void enqueue(Job&& job);
+	void work();
+	void encode(Job& job);
+	void write_y4m(const Job& job);
+};
+
+} // namespace ori
+
+#endif // RECORDER_HPP_
@@ -0,0 +1,209 @@
+// render_queue.cpp
+#include "render_queue.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Logger.hpp"
+#include "state_cache.hpp"
+
+namespace ori
+{
+
+static constexpr std::uint32_t index_bits = 12;
+static constexpr std::uint32_t depth_bits = 24;
+static constexpr std::uint32_t max_index = (1 << index_bits) - 1;
+static constexpr std::uint32_t max_depth = (1 << depth_bits) - 1;
+static constexpr std::uint32_t layer_shift = 60;
+
+RenderQueueException::RenderQueueException()
+: std::runtime_error("Render queue exception")
+{
+}
+
+auto RenderQueueStats::saved() const noexcept -> std::size_t
+{
+	return unsorted_state_changes > state_changes ? unsorted_state_changes - state_changes : 0;
+}
+
+/*
+ * State bound while walking the queue, apply() returns how many changes a draw needs
+ */
+struct BoundState
+{
+	const ShaderProgram* program = nullptr;
+	const MeshBase* mesh = nullptr;
+	std::uint32_t texture = 0;
+	int blend = -1;
+
+	auto apply(const RenderCommand& command, bool translucent, bool issue) -> std::size_t
+	{
+		std::size_t changes = 0;
+		if (blend != translucent)
+		{
+			blend = translucent;
+			if (issue)
+				set_alpha(translucent);
+			++changes;
+		}
+		if (program != command.program)
+		{
+			program = command.program;
+			if (issue)
+				program->bind();
+			++changes;
+		}
+		// texture 0 keeps whatever is bound
+		if (command.texture && texture != command.texture)
+		{
+			texture = command.texture;
+			if (issue)
+				StateCache::get().bind_texture(0, texture);
+			++changes;
+		}
+		if (mesh != command.mesh)
+		{
+			mesh = command.mesh;
+			if (issue)
+				mesh->bind();
+			++changes;
+		}
+		return changes;
+	}
+};
+
+template <class K>
+static auto dense_index(std::unordered_map<K, std::uint32_t>& indices, K key, std::uint32_t first) -> std::uint32_t
+{
+	auto [it, inserted] = indices.try_emplace(key, static_cast<std::uint32_t>(indices.size()) + first);
+	if (it->second > max_index)
+	{
+		indices.erase(it);
+		Logger::get().error({"Render queue holds more than {} programs, textures or meshes"}, max_index);
+		throw RenderQueueException();
+	}
+	return it->second;
+}
+
+void RenderQueue::set_translucent(std::uint32_t layer, bool value)
+{
+	if (layer >= max_layers)
+	{
+		Logger::get().error({"Render queue layer {} is out of range"}, layer);
+		throw RenderQueueException();
+	}
+	translucent[layer] = value;
+}
+
+void RenderQueue::submit(std::uint32_t layer, float depth, const RenderCommand& command)
+{
+	if (layer >= max_layers || !command.program || !command.mesh)
+	{
+		Logger::get().error({"Render queue draw needs a layer below {}, a program and a mesh"}, max_layers);
+		throw RenderQueueException();
+	}
+
+	const std::uint64_t program = dense_index<const void*>(programs, command.program, 0);
+	const std::uint64_t texture = command.texture ? dense_index(textures, command.texture, 1) : 0;
+	const std::uint64_t mesh = dense_index<const void*>(meshes, command.mesh, 0);
+	// NaN passes through clamp and can't be converted, sort it to the front
+	const float normalized = std::isnan(depth) ? 0.0f : std::clamp(depth, 0.0f, 1.0f);
+	const std::uint64_t z = normalized * max_depth;
+
+	std::uint64_t key = std::uint64_t(layer) << layer_shift;
+	if (translucent[layer])
+	{
+		// back to front, state only breaks ties
+		key |= (max_depth - z) << (3 * index_bits);
+		key |= program << (2 * index_bits);
+		key |= texture << index_bits;
+		key |= mesh;
+	}
+	else
+	{
+		key |= program << (depth_bits + 2 * index_bits);
+		key |= texture << (depth_bits + index_bits);
+		key |= mesh << depth_bits;
+		key |= z;
+	}
+
+	items.push_back({ key, static_cast<std::uint32_t>(commands.size()) });
+	commands.push_back(command);
+}
+
+auto RenderQueue::flush() -> RenderQueueStats
+{
+	_stats = {};
+	_stats.draws = items.size();
+
+	BoundState submitted;
+	for (const auto& item : items)
+	{
+		const bool blend = translucent[item.key >> layer_shift];
+		_stats.unsorted_state_changes += submitted.apply(commands[item.command], blend, false);
+	}
+
+	sort();
+	execute();
+
+	commands.clear();
+	items.clear();
+	programs.clear();
+	textures.clear();
+	meshes.clear();
+	return _stats;
+}
+
+auto RenderQueue::size() const noexcept -> std::size_t
+{
+	return items.size();
+}
+
+auto RenderQueue::stats() const noexcept -> const RenderQueueStats&
+{
+	return _stats;
+}
+
+void RenderQueue::sort()
+{
+	// LSD radix sort on bytes, stable so equal keys keep submission order
+	scratch.resize(items.size());
+	for (std::uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		std::array<std::size_t, 256> offsets = {};
+		for (const auto& item : items)
+			++offsets[(item.key >> shift) & 0xFF];
+
+		// every key shares this byte
+		if (std::find(offsets.begin(), offsets.end(), items.size()) != offsets.end())
+			continue;
+
+		std::size_t sum = 0;
+		for (auto& offset : offsets)
+		{
+			auto count = offset;
+			offset = sum;
+			sum += count;
+		}
+
+		for (const auto& item : items)
+			scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+
+		items.swap(scratch);
+	}
+}
+
+void RenderQueue::execute()
+{
+	BoundState bound;
+	for (const auto& item : items)
+	{
+		const auto& command = commands[item.command];
+		const bool blend = translucent[item.key >> layer_shift];
+		_stats.state_changes += bound.apply(command, blend, true);
+
+		draw_triangles_instanced(command.range, command.instances, command.base_instance);
+	}
+}
+
+} // namespace ori
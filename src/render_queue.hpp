@@ -0,0 +1,103 @@
+// render_queue.hpp
+#ifndef RENDER_QUEUE_HPP_
+#define RENDER_QUEUE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+class RenderQueueException : public std::runtime_error
+{
+public:
+	RenderQueueException();
+};
+
+/*
+ * A draw, the texture id is bound to unit 0 unless it is 0
+ * Per draw data is best read from a buffer indexed by base_instance
+ */
+struct RenderCommand
+{
+	const ShaderProgram* program = nullptr;
+	const MeshBase* mesh = nullptr;
+	std::uint32_t texture = 0;
+	MeshRange range;
+	std::uint32_t instances = 1;
+	std::uint32_t base_instance = 0;
+};
+
+struct RenderQueueStats
+{
+	std::size_t draws = 0;
+
+	// Program, texture, mesh and blend changes in the executed order
+	std::size_t state_changes = 0;
+
+	// Changes the same draws would have needed in submission order
+	std::size_t unsorted_state_changes = 0;
+
+	auto saved() const noexcept -> std::size_t;
+};
+
+/*
+ * Collects draws as 64 bit sort keys and executes them sorted by state
+ *
+ * Keys are layer (4 bits), program (12), texture (12), mesh (12) and depth (24),
+ * so draws run layer by layer, grouped by program, then texture, then mesh and
+ * front to back within a group. Translucent layers blend and move depth above
+ * the state bits so they draw back to front. Depth is clamped to [0, 1], e.g.
+ * view distance / far plane, and NaN counts as 0. Up to 4095 programs, textures
+ * and meshes per frame.
+ */
+class RenderQueue
+{
+public:
+	static constexpr std::uint32_t max_layers = 16;
+
+	void set_translucent(std::uint32_t layer, bool translucent);
+
+	void submit(std::uint32_t layer, float depth, const RenderCommand& command);
+
+	// Sort, draw and clear the queue
+	auto flush() -> RenderQueueStats;
+
+	auto size() const noexcept -> std::size_t;
+
+	// Stats of the last flush
+	auto stats() const noexcept -> const RenderQueueStats&;
+
+private:
+	struct SortItem
+	{
+		std::uint64_t key;
+		std::uint32_t command;
+	};
+
+	std::array<bool, max_layers> translucent = {};
+
+	std::vector<RenderCommand> commands;
+	std::vector<SortItem> items;
+	std::vector<SortItem> scratch;
+
+	// Dense indices of the objects seen this frame, 0 is reserved for no texture
+	std::unordered_map<const void*, std::uint32_t> programs;
+	std::unordered_map<std::uint32_t, std::uint32_t> textures;
+	std::unordered_map<const void*, std::uint32_t> meshes;
+
+	RenderQueueStats _stats;
+
+	void sort();
+	void execute();
+};
+
+} // namespace ori
+
+#endif // RENDER_QUEUE_HPP_
@@ -0,0 +1,308 @@
+// shader_library.cpp
+#include "shader_library.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <utility>
+
+#include "Logger.hpp"
+
+namespace ori
+{
+
+struct ShaderPreprocessor::Expansion
+{
+	std::vector<std::string> files;
+	std::vector<std::string> stack;
+	std::vector<std::string> once;
+	bool has_version = false;
+};
+
+static auto read_file(const std::string& path) -> std::string
+{
+	auto file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		Logger::get().error({"Unable to open {}"}, path);
+		throw ShaderException();
+	}
+
+	std::string contents;
+	std::array<char, 65536> chunk;
+	std::size_t count = 0;
+	while ((count = std::fread(chunk.data(), 1, chunk.size(), file)) > 0)
+		contents.append(chunk.data(), count);
+
+	std::fclose(file);
+	return contents;
+}
+
+static auto trim_front(std::string_view text) noexcept -> std::string_view
+{
+	const auto first = text.find_first_not_of(" \t");
+	return first == std::string_view::npos ? std::string_view() : text.substr(first);
+}
+
+static auto starts_with(std::string_view text, std::string_view prefix) noexcept -> bool
+{
+	return text.substr(0, prefix.size()) == prefix;
+}
+
+// Length prefixed so no part can run into the next, "ab" + "c" != "a" + "bc"
+static void append_key(std::string& key, std::string_view part)
+{
+	key += std::to_string(part.size());
+	key += ':';
+	key += part;
+}
+
+// "#  include" is as valid as "#include"
+static auto directive(std::string_view line, std::string_view name) noexcept -> std::string_view
+{
+	line = trim_front(line);
+	if (!starts_with(line, "#"))
+		return {};
+
+	line = trim_front(line.substr(1));
+	if (!starts_with(line, name))
+		return {};
+
+	const auto rest = line.substr(name.size());
+	if (!rest.empty() && rest.front() != ' ' && rest.front() != '\t' && rest.front() != '"' && rest.front() != '<')
+		return {};
+
+	return rest.empty() ? line : rest;
+}
+
+ShaderPreprocessor::ShaderPreprocessor(std::vector<std::string> __include_paths)
+: include_paths(std::move(__include_paths))
+{
+}
+
+void ShaderPreprocessor::add_file(std::string name, std::string contents)
+{
+	virtual_files.insert_or_assign(std::move(name), std::move(contents));
+}
+
+auto ShaderPreprocessor::process(const std::string& path,
+		const std::vector<std::string>& defines,
+		std::vector<std::string>* files) const
+-> std::string
+{
+	auto it = virtual_files.find(path);
+	const auto contents = it != virtual_files.end() ? it->second : read_file(path);
+
+	Expansion expansion;
+	std::string output;
+	expand(path, contents, expansion, output);
+
+	if (files)
+		*files = std::move(expansion.files);
+	return inject_defines(output, defines);
+}
+
+auto ShaderPreprocessor::process_source(std::string_view source,
+		const std::vector<std::string>& defines,
+		std::vector<std::string>* files) const
+-> std::string
+{
+	Expansion expansion;
+	std::string output;
+	expand("<source>", source, expansion, output);
+
+	if (files)
+		*files = std::move(expansion.files);
+	return inject_defines(output, defines);
+}
+
+auto ShaderPreprocessor::resolve(std::string_view target, bool quoted, const std::string& from) const
+-> std::pair<std::string, std::string>
+{
+	const std::string name(target);
+	if (auto it = virtual_files.find(name); it != virtual_files.end())
+		return *it;
+
+	std::vector<std::filesystem::path> candidates;
+	if (quoted)
+		candidates.push_back(std::filesystem::path(from).parent_path() / name);
+	for (const auto& include_path : include_paths)
+		candidates.push_back(std::filesystem::path(include_path) / name);
+
+	for (const auto& candidate : candidates)
+	{
+		std::error_code error;
+		if (std::filesystem::is_regular_file(candidate, error))
+		{
+			auto path = candidate.lexically_normal().string();
+			auto contents = read_file(path);
+			return {std::move(path), std::move(contents)};
+		}
+	}
+
+	Logger::get().error({"Unable to resolve #include {} in {}"}, name, from);
+	throw ShaderException();
+}
+
+void ShaderPreprocessor::expand(const std::string& name,
+		std::string_view contents,
+		Expansion& expansion,
+		std::string& output) const
+{
+	if (std::find(expansion.stack.begin(), expansion.stack.end(), name) != expansion.stack.end())
+	{
+		Logger::get().error({"Recursive #include of {}"}, name);
+		throw ShaderException();
+	}
+
+	const auto index = expansion.files.size();
+	expansion.files.push_back(name);
+	expansion.stack.push_back(name);
+
+	if (index > 0)
+		output += "#line 1 " + std::to_string(index) + "\n";
+
+	std::size_t line_number = 0;
+	while (!contents.empty())
+	{
+		++line_number;
+		const auto end = contents.find('\n');
+		auto line = contents.substr(0, end);
+		contents = end == std::string_view::npos ? std::string_view() : contents.substr(end + 1);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+
+		const auto resume = "#line " + std::to_string(line_number + 1) + " " + std::to_string(index) + "\n";
+
+		if (auto include = directive(line, "include"); !include.empty())
+		{
+			include = trim_front(include);
+			const bool quoted = starts_with(include, "\"");
+			const auto close = include.find(quoted ? '"' : '>', 1);
+			if ((!quoted && !starts_with(include, "<")) || close == std::string_view::npos)
+			{
+				Logger::get().error({"Malformed #include in {} line {}"}, name, line_number);
+				throw ShaderException();
+			}
+
+			auto [path, source] = resolve(include.substr(1, close - 1), quoted, name);
+			if (std::find(expansion.once.begin(), expansion.once.end(), path) != expansion.once.end())
+			{
+				output += "\n";
+				continue;
+			}
+
+			expand(path, source, expansion, output);
+			output += resume;
+		}
+		else if (auto pragma = directive(line, "pragma"); !pragma.empty() && trim_front(pragma) == "once")
+		{
+			expansion.once.push_back(name);
+			output += "\n";
+		}
+		else if (!directive(line, "version").empty())
+		{
+			// only the first #version survives, defines are injected right after it
+			if (index == 0 && !expansion.has_version)
+			{
+				expansion.has_version = true;
+				output += std::string(line) + "\n" + resume;
+			}
+			else
+			{
+				output += "\n";
+			}
+		}
+		else
+		{
+			output += line;
+			output += "\n";
+		}
+	}
+
+	expansion.stack.pop_back();
+}
+
+ShaderLibrary::ShaderLibrary(ShaderPreprocessor __preprocessor, ProgramCache* __binaries)
+: preprocessor(std::move(__preprocessor))
+, binaries(__binaries)
+{
+}
+
+auto ShaderLibrary::get(const std::vector<ShaderFile>& stages, std::vector<std::string> defines) -> ShaderProgram&
+{
+	std::sort(defines.begin(), defines.end());
+	defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+
+	std::string variant;
+	for (const auto& stage : stages)
+	{
+		append_key(variant, std::to_string(static_cast<std::uint32_t>(stage.stage)));
+		append_key(variant, stage.path);
+	}
+	variant += '|';
+	for (const auto& define : defines)
+		append_key(variant, define);
+
+	if (auto it = variants.find(variant); it != variants.end())
+		return *it->second;
+
+	std::vector<ShaderSource> sources;
+	std::string expanded;
+	for (const auto& stage : stages)
+	{
+		sources.push_back({stage.stage, preprocessor.process(stage.path, defines)});
+		append_key(expanded, std::to_string(static_cast<std::uint32_t>(stage.stage)));
+		append_key(expanded, sources.back().source);
+	}
+
+	auto it = programs_by_source.find(expanded);
+	if (it == programs_by_source.end())
+		it = programs_by_source.emplace(std::move(expanded), build(sources)).first;
+
+	variants.emplace(std::move(variant), it->second.get());
+	return *it->second;
+}
+
+auto ShaderLibrary::programs() const noexcept -> std::size_t
+{
+	return programs_by_source.size();
+}
+
+auto ShaderLibrary::compiles() const noexcept -> std::size_t
+{
+	return _compiles;
+}
+
+auto ShaderLibrary::build(const std::vector<ShaderSource>& sources) -> std::unique_ptr<ShaderProgram>
+{
+	if (binaries)
+	{
+		if (auto program = binaries->find(sources))
+			return std::make_unique<ShaderProgram>(std::move(*program));
+	}
+
+	std::vector<std::uint32_t> ids;
+	for (const auto& source : sources)
+	{
+		std::string key;
+		append_key(key, std::to_string(static_cast<std::uint32_t>(source.stage)));
+		append_key(key, source.source);
+
+		auto it = shaders.find(key);
+		if (it == shaders.end())
+		{
+			it = shaders.emplace(std::move(key), compile(source)).first;
+			++_compiles;
+		}
+		ids.push_back(shader_id(it->second));
+	}
+
+	auto program = std::make_unique<ShaderProgram>(ids, binaries != nullptr);
+	if (binaries)
+		binaries->store(sources, {}, *program);
+	return program;
+}
+
+} // namespace ori
@@ -0,0 +1,92 @@
+// shader_library.hpp
+#ifndef SHADER_LIBRARY_HPP_
+#define SHADER_LIBRARY_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "program_cache.hpp"
+#include "wrappers.hpp"
+
+namespace ori
+{
+
+/*
+ * Resolves #include "file" and #include <file>, honours #pragma once and
+ * injects #defines after #version. Quoted includes are searched next to the
+ * including file first, then in the include paths. #line directives number
+ * every file, files lists the name of each source string number.
+ */
+class ShaderPreprocessor
+{
+public:
+	explicit ShaderPreprocessor(std::vector<std::string> include_paths = {});
+
+	// In-memory file, found by name before the filesystem is searched
+	void add_file(std::string name, std::string contents);
+
+	auto process(const std::string& path,
+			const std::vector<std::string>& defines = {},
+			std::vector<std::string>* files = nullptr) const
+	-> std::string;
+
+	auto process_source(std::string_view source,
+			const std::vector<std::string>& defines = {},
+			std::vector<std::string>* files = nullptr) const
+	-> std::string;
+
+private:
+	struct Expansion;
+
+	std::vector<std::string> include_paths;
+	std::unordered_map<std::string, std::string> virtual_files;
+
+	auto resolve(std::string_view target, bool quoted, const std::string& from) const
+	-> std::pair<std::string, std::string>;
+	void expand(const std::string& name, std::string_view contents, Expansion& expansion, std::string& output) const;
+};
+
+struct ShaderFile
+{
+	ShaderStage stage;
+	std::string path;
+};
+
+/*
+ * Programs built from preprocessed shader files, one per define set
+ *
+ * A variant is built at most once per library. Variants whose expanded
+ * sources are identical share a program, and identical expanded stages
+ * share one compiled shader object. With a ProgramCache, variants are
+ * loaded from disk before anything is compiled.
+ */
+class ShaderLibrary
+{
+public:
+	explicit ShaderLibrary(ShaderPreprocessor preprocessor, ProgramCache* binaries = nullptr);
+
+	// Defines are NAME or NAME VALUE, their order does not matter
+	auto get(const std::vector<ShaderFile>& stages, std::vector<std::string> defines = {}) -> ShaderProgram&;
+
+	auto programs() const noexcept -> std::size_t;
+	auto compiles() const noexcept -> std::size_t;
+
+private:
+	ShaderPreprocessor preprocessor;
+	ProgramCache* binaries;
+	// Keyed by the full stage paths and defines or expanded sources, not a hash of them
+	std::unordered_map<std::string, ShaderProgram*> variants;
+	std::unordered_map<std::string, std::unique_ptr<ShaderProgram>> programs_by_source;
+	std::unordered_map<std::string, Shader> shaders;
+	std::size_t _compiles = 0;
+
+	auto build(const std::vector<ShaderSource>& sources) -> std::unique_ptr<ShaderProgram>;
+};
+
+} // namespace ori
+
+#endif // SHADER_LIBRARY_HPP_
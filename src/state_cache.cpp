@@ -0,0 +1,457 @@
+// state_cache.cpp
+#include "state_cache.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "Logger.hpp"
+
+namespace ori
+{
+
+StateException::StateException()
+: std::runtime_error("State exception")
+{
+}
+
+struct BufferTarget
+{
+	GLenum target;
+	GLenum query;
+};
+
+static constexpr BufferTarget buffer_targets[] = {
+	{ GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER_BINDING },
+	{ GL_PARAMETER_BUFFER, GL_PARAMETER_BUFFER_BINDING },
+	{ GL_PIXEL_PACK_BUFFER, GL_PIXEL_PACK_BUFFER_BINDING },
+	{ GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING },
+	{ GL_DISPATCH_INDIRECT_BUFFER, GL_DISPATCH_INDIRECT_BUFFER_BINDING },
+};
+
+static_assert(std::size(buffer_targets) == 5, "buffer_target_count is out of date");
+
+static auto query(GLenum name) -> std::int64_t
+{
+	GLint64 value = 0;
+	glGetInteger64v(name, &value);
+	return value;
+}
+
+static auto query(GLenum name, GLuint index) -> std::int64_t
+{
+	GLint64 value = 0;
+	glGetInteger64i_v(name, index, &value);
+	return value;
+}
+
+static void check(GLenum binding, std::int64_t shadow, std::int64_t actual, GLuint index = 0)
+{
+	if (shadow != actual)
+	{
+		Logger::get().error({"State cache expected 0x{:04X}[{}] to be {} but it is {}"}, binding, index, shadow, actual);
+		throw StateException();
+	}
+}
+
+StateCache StateCache::instance = StateCache();
+
+StateCache::StateCache()
+{
+	buffers.fill(unknown);
+}
+
+auto StateCache::get() -> StateCache&
+{
+	return instance;
+}
+
+bool StateCache::use_program(std::uint32_t __program)
+{
+	if (!change(program, __program, GL_CURRENT_PROGRAM))
+		return false;
+
+	glUseProgram(__program);
+	return true;
+}
+
+bool StateCache::bind_program_pipeline(std::uint32_t __pipeline)
+{
+	if (!change(pipeline, __pipeline, GL_PROGRAM_PIPELINE_BINDING))
+		return false;
+
+	glBindProgramPipeline(__pipeline);
+	return true;
+}
+
+bool StateCache::bind_vertex_array(std::uint32_t __vertex_array, std::uint32_t index_type)
+{
+	_index_type = index_type;
+	if (!change(vertex_array, __vertex_array, GL_VERTEX_ARRAY_BINDING))
+		return false;
+
+	glBindVertexArray(__vertex_array);
+	return true;
+}
+
+bool StateCache::bind_texture(std::uint32_t unit, std::uint32_t texture)
+{
+	if (unit >= textures.size())
+		textures.resize(unit + 1, unknown);
+
+	if (textures[unit] == texture)
+	{
+		if (_validation)
+			check_texture(unit);
+
+		++_skipped;
+		return false;
+	}
+
+	glBindTextureUnit(unit, texture);
+	textures[unit] = texture;
+	++_issued;
+	return true;
+}
+
+bool StateCache::bind_buffer(std::uint32_t target, std::uint32_t buffer)
+{
+	for (std::size_t i = 0; i < buffers.size(); ++i)
+	{
+		if (buffer_targets[i].target == target)
+		{
+			if (!change(buffers[i], buffer, buffer_targets[i].query))
+				return false;
+
+			glBindBuffer(target, buffer);
+			return true;
+		}
+	}
+
+	// untracked target
+	glBindBuffer(target, buffer);
+	++_issued;
+	return true;
+}
+
+bool StateCache::bind_buffer_range(std::uint32_t target,
+		std::uint32_t index,
+		std::uint32_t buffer,
+		std::size_t offset,
+		std::size_t size)
+{
+	auto* shadows = ranges(target);
+	if (shadows)
+	{
+		if (index >= shadows->size())
+			shadows->resize(index + 1);
+
+		auto& shadow = (*shadows)[index];
+		if (shadow.buffer == buffer && shadow.offset == offset && shadow.size == size)
+		{
+			if (_validation)
+				check_range(target, index);
+
+			++_skipped;
+			return false;
+		}
+
+		shadow = { buffer, offset, size };
+	}
+
+	if (size)
+		glBindBufferRange(target, index, buffer, offset, size);
+	else
+		glBindBufferBase(target, index, buffer);
+
+	++_issued;
+	return true;
+}
+
+bool StateCache::bind_framebuffer(std::uint32_t target, std::uint32_t framebuffer)
+{
+	if (target == GL_FRAMEBUFFER)
+	{
+		if (draw_framebuffer == framebuffer && read_framebuffer == framebuffer)
+		{
+			if (_validation)
+			{
+				check(GL_DRAW_FRAMEBUFFER_BINDING, framebuffer, query(GL_DRAW_FRAMEBUFFER_BINDING));
+				check(GL_READ_FRAMEBUFFER_BINDING, framebuffer, query(GL_READ_FRAMEBUFFER_BINDING));
+			}
+
+			++_skipped;
+			return false;
+		}
+
+		draw_framebuffer = framebuffer;
+		read_framebuffer = framebuffer;
+		++_issued;
+	}
+	else if (target == GL_READ_FRAMEBUFFER)
+	{
+		if (!change(read_framebuffer, framebuffer, GL_READ_FRAMEBUFFER_BINDING))
+			return false;
+	}
+	else if (!change(draw_framebuffer, framebuffer, GL_DRAW_FRAMEBUFFER_BINDING))
+	{
+		return false;
+	}
+
+	glBindFramebuffer(target, framebuffer);
+	return true;
+}
+
+bool StateCache::set_blend(bool enabled)
+{
+	if (!change(blend, enabled, GL_BLEND))
+		return false;
+
+	if (enabled)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+	return true;
+}
+
+bool StateCache::set_blend_func(std::uint32_t source, std::uint32_t destination)
+{
+	if (blend_source == source && blend_destination == destination)
+	{
+		if (_validation)
+		{
+			check(GL_BLEND_SRC_RGB, source, query(GL_BLEND_SRC_RGB));
+			check(GL_BLEND_DST_RGB, destination, query(GL_BLEND_DST_RGB));
+		}
+
+		++_skipped;
+		return false;
+	}
+
+	glBlendFunc(source, destination);
+	blend_source = source;
+	blend_destination = destination;
+	++_issued;
+	return true;
+}
+
+bool StateCache::set_pack_alignment(std::uint32_t alignment)
+{
+	if (!change(pack_alignment, alignment, GL_PACK_ALIGNMENT))
+		return false;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+	return true;
+}
+
+auto StateCache::bound_read_framebuffer() -> std::uint32_t
+{
+	if (read_framebuffer == unknown)
+		read_framebuffer = static_cast<std::uint32_t>(query(GL_READ_FRAMEBUFFER_BINDING));
+	else if (_validation)
+		check(GL_READ_FRAMEBUFFER_BINDING, read_framebuffer, query(GL_READ_FRAMEBUFFER_BINDING));
+
+	return read_framebuffer;
+}
+
+void StateCache::set_index_type(std::uint32_t __vertex_array, std::uint32_t index_type) noexcept
+{
+	if (vertex_array == __vertex_array)
+		_index_type = index_type;
+}
+
+auto StateCache::index_type() const noexcept -> std::uint32_t
+{
+	return _index_type;
+}
+
+void StateCache::forget_program(std::uint32_t __program) noexcept
+{
+	if (program == __program)
+		program = unknown;
+}
+
+void StateCache::forget_program_pipeline(std::uint32_t __pipeline) noexcept
+{
+	if (pipeline == __pipeline)
+		pipeline = unknown;
+}
+
+void StateCache::forget_vertex_array(std::uint32_t __vertex_array) noexcept
+{
+	if (vertex_array == __vertex_array)
+		vertex_array = unknown;
+}
+
+void StateCache::forget_texture(std::uint32_t texture) noexcept
+{
+	std::replace(textures.begin(), textures.end(), texture, unknown);
+}
+
+void StateCache::forget_buffer(std::uint32_t buffer) noexcept
+{
+	std::replace(buffers.begin(), buffers.end(), buffer, unknown);
+
+	for (auto* shadows : { &uniform_ranges, &storage_ranges })
+	{
+		for (auto& range : *shadows)
+		{
+			if (range.buffer == buffer)
+				range = {};
+		}
+	}
+}
+
+void StateCache::forget_framebuffer(std::uint32_t framebuffer) noexcept
+{
+	if (draw_framebuffer == framebuffer)
+		draw_framebuffer = unknown;
+	if (read_framebuffer == framebuffer)
+		read_framebuffer = unknown;
+}
+
+void StateCache::invalidate() noexcept
+{
+	program = unknown;
+	pipeline = unknown;
+	vertex_array = unknown;
+	draw_framebuffer = unknown;
+	read_framebuffer = unknown;
+	blend = unknown;
+	blend_source = unknown;
+	blend_destination = unknown;
+	pack_alignment = unknown;
+	textures.clear();
+	buffers.fill(unknown);
+	uniform_ranges.clear();
+	storage_ranges.clear();
+}
+
+void StateCache::set_validation(bool enabled) noexcept
+{
+	_validation = enabled;
+}
+
+auto StateCache::validation() const noexcept -> bool
+{
+	return _validation;
+}
+
+void StateCache::validate() const
+{
+	const std::pair<std::uint32_t, GLenum> scalars[] = {
+		{ program, GL_CURRENT_PROGRAM },
+		{ pipeline, GL_PROGRAM_PIPELINE_BINDING },
+		{ vertex_array, GL_VERTEX_ARRAY_BINDING },
+		{ draw_framebuffer, GL_DRAW_FRAMEBUFFER_BINDING },
+		{ read_framebuffer, GL_READ_FRAMEBUFFER_BINDING },
+		{ blend, GL_BLEND },
+		{ blend_source, GL_BLEND_SRC_RGB },
+		{ blend_destination, GL_BLEND_DST_RGB },
+		{ pack_alignment, GL_PACK_ALIGNMENT },
+	};
+
+	for (auto [shadow, name] : scalars)
+	{
+		if (shadow != unknown)
+			check(name, shadow, query(name));
+	}
+
+	for (std::size_t i = 0; i < buffers.size(); ++i)
+	{
+		if (buffers[i] != unknown)
+			check(buffer_targets[i].query, buffers[i], query(buffer_targets[i].query));
+	}
+
+	for (std::uint32_t unit = 0; unit < textures.size(); ++unit)
+	{
+		if (textures[unit] != unknown)
+			check_texture(unit);
+	}
+
+	for (GLenum target : { GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER })
+	{
+		const auto& shadows = target == GL_UNIFORM_BUFFER ? uniform_ranges : storage_ranges;
+		for (std::uint32_t index = 0; index < shadows.size(); ++index)
+		{
+			if (shadows[index].buffer != unknown)
+				check_range(target, index);
+		}
+	}
+}
+
+auto StateCache::issued() const noexcept -> std::size_t
+{
+	return _issued;
+}
+
+auto StateCache::skipped() const noexcept -> std::size_t
+{
+	return _skipped;
+}
+
+void StateCache::reset_counters() noexcept
+{
+	_issued = 0;
+	_skipped = 0;
+}
+
+bool StateCache::change(std::uint32_t& shadow, std::uint32_t value, std::uint32_t binding)
+{
+	if (shadow == value)
+	{
+		if (_validation)
+			check(binding, shadow, query(binding));
+
+		++_skipped;
+		return false;
+	}
+
+	shadow = value;
+	++_issued;
+	return true;
+}
+
+auto StateCache::ranges(std::uint32_t target) noexcept -> std::vector<BufferRange>*
+{
+	switch (target)
+	{
+	case GL_UNIFORM_BUFFER:
+		return &uniform_ranges;
+	case GL_SHADER_STORAGE_BUFFER:
+		return &storage_ranges;
+	default:
+		return nullptr;
+	}
+}
+
+void StateCache::check_texture(std::uint32_t unit) const
+{
+	// there is no target independent query, the wrappers bind 2D and 2D array textures
+	GLint active = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	auto texture_2d = query(GL_TEXTURE_BINDING_2D);
+	auto texture_array = query(GL_TEXTURE_BINDING_2D_ARRAY);
+	glActiveTexture(active);
+
+	const auto texture = textures[unit];
+	check(GL_TEXTURE_BINDING_2D, texture, texture == texture_array ? texture_array : texture_2d, unit);
+}
+
+void StateCache::check_range(std::uint32_t target, std::uint32_t index) const
+{
+	const bool uniform = target == GL_UNIFORM_BUFFER;
+	const auto& shadow = (uniform ? uniform_ranges : storage_ranges)[index];
+	const GLenum binding = uniform ? GL_UNIFORM_BUFFER_BINDING : GL_SHADER_STORAGE_BUFFER_BINDING;
+	const GLenum start = uniform ? GL_UNIFORM_BUFFER_START : GL_SHADER_STORAGE_BUFFER_START;
+	const GLenum size = uniform ? GL_UNIFORM_BUFFER_SIZE : GL_SHADER_STORAGE_BUFFER_SIZE;
+
+	check(binding, shadow.buffer, query(binding, index), index);
+	check(start, shadow.offset, query(start, index), index);
+	check(size, shadow.size, query(size, index), index);
+}
+
+} // namespace ori
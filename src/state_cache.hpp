@@ -0,0 +1,135 @@
+// state_cache.hpp
+#ifndef STATE_CACHE_HPP_
+#define STATE_CACHE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace ori
+{
+
+class StateException : public std::runtime_error
+{
+public:
+	StateException();
+};
+
+/*
+ * Shadow of the bound context state, calls that wouldn't change anything are skipped
+ *
+ * The wrappers bind through the cache and forget objects as they are deleted.
+ * Code that touches the same state behind its back (UI libraries, raw GL) must
+ * call invalidate() afterwards. Targets are GL enums, e.g. GL_UNIFORM_BUFFER.
+ */
+class StateCache
+{
+public:
+	// GL_UNSIGNED_INT, the index type of meshes that don't say otherwise
+	static constexpr std::uint32_t unsigned_int = 0x1405;
+
+	static auto get() -> StateCache&;
+
+	// Each returns false if the call was skipped
+	bool use_program(std::uint32_t program);
+	bool bind_program_pipeline(std::uint32_t pipeline);
+	// The index type goes with the vertex array, draws read it from index_type()
+	bool bind_vertex_array(std::uint32_t vertex_array, std::uint32_t index_type = unsigned_int);
+	bool bind_texture(std::uint32_t unit, std::uint32_t texture);
+	bool bind_buffer(std::uint32_t target, std::uint32_t buffer);
+
+	// A size of 0 binds the whole buffer
+	bool bind_buffer_range(std::uint32_t target,
+			std::uint32_t index,
+			std::uint32_t buffer,
+			std::size_t offset = 0,
+			std::size_t size = 0);
+
+	// GL_FRAMEBUFFER binds both the draw and read framebuffer
+	bool bind_framebuffer(std::uint32_t target, std::uint32_t framebuffer);
+	bool set_blend(bool enabled);
+	bool set_blend_func(std::uint32_t source, std::uint32_t destination);
+	bool set_pack_alignment(std::uint32_t alignment);
+
+	// Read framebuffer bound right now, queried once if the shadow doesn't know
+	auto bound_read_framebuffer() -> std::uint32_t;
+
+	// Updates the index type if the vertex array is bound
+	void set_index_type(std::uint32_t vertex_array, std::uint32_t index_type) noexcept;
+
+	// GL_UNSIGNED_* type of the vertex array last bound through the cache
+	auto index_type() const noexcept -> std::uint32_t;
+
+	// Called as objects are deleted, GL resets their bindings
+	void forget_program(std::uint32_t program) noexcept;
+	void forget_program_pipeline(std::uint32_t pipeline) noexcept;
+	void forget_vertex_array(std::uint32_t vertex_array) noexcept;
+	void forget_texture(std::uint32_t texture) noexcept;
+	void forget_buffer(std::uint32_t buffer) noexcept;
+	void forget_framebuffer(std::uint32_t framebuffer) noexcept;
+
+	// Forget everything, the next call of each kind is issued
+	void invalidate() noexcept;
+
+	/*
+	 * Validation compares the shadow against glGet* before every skipped call,
+	 * a mismatch is logged and throws StateException. Slow, meant for debugging.
+	 */
+	void set_validation(bool enabled) noexcept;
+	auto validation() const noexcept -> bool;
+
+	// Compare all known state against glGet*, throws StateException on mismatch
+	void validate() const;
+
+	auto issued() const noexcept -> std::size_t;
+	auto skipped() const noexcept -> std::size_t;
+	void reset_counters() noexcept;
+
+private:
+	// Shadow value of state that must be queried or rebound
+	static constexpr std::uint32_t unknown = 0xFFFFFFFF;
+
+	struct BufferRange
+	{
+		std::uint32_t buffer = unknown;
+		std::size_t offset = 0;
+		std::size_t size = 0;
+	};
+
+	// Targets with a single binding point, see state_cache.cpp
+	static constexpr std::size_t buffer_target_count = 5;
+
+	StateCache();
+	static StateCache instance;
+
+	std::uint32_t program = unknown;
+	std::uint32_t pipeline = unknown;
+	std::uint32_t vertex_array = unknown;
+	std::uint32_t _index_type = unsigned_int;
+	std::uint32_t draw_framebuffer = unknown;
+	std::uint32_t read_framebuffer = unknown;
+	std::uint32_t blend = unknown;
+	std::uint32_t blend_source = unknown;
+	std::uint32_t blend_destination = unknown;
+	std::uint32_t pack_alignment = unknown;
+	std::vector<std::uint32_t> textures;
+	std::array<std::uint32_t, buffer_target_count> buffers;
+	std::vector<BufferRange> uniform_ranges;
+	std::vector<BufferRange> storage_ranges;
+
+	bool _validation = false;
+	std::size_t _issued = 0;
+	std::size_t _skipped = 0;
+
+	// Returns true if the call must be issued, updating the shadow and counters
+	bool change(std::uint32_t& shadow, std::uint32_t value, std::uint32_t query);
+	auto ranges(std::uint32_t target) noexcept -> std::vector<BufferRange>*;
+	void check_texture(std::uint32_t unit) const;
+	void check_range(std::uint32_t target, std::uint32_t index) const;
+};
+
+} // namespace ori
+
+#endif // STATE_CACHE_HPP_
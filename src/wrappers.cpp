@@ -1,6 +1,8 @@
 // utils.cpp
 #include "wrappers.hpp"
 
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 #include <glm/vec2.hpp>
@@ -11,6 +13,7 @@
 #include <glad/glad.h>
 
 #include "Logger.hpp"
+#include "state_cache.hpp"
 
 #if __GNUC__
 #	pragma GCC diagnostic push
@@ -217,6 +220,20 @@ ComputeShaderHandle::~ComputeShaderHandle()
 	}
 }
 
+ShaderHandle::ShaderHandle(std::uint32_t type)
+{
+	_id = glCreateShader(type);
+}
+
+ShaderHandle::~ShaderHandle()
+{
+	if (_id)
+	{
+		glDeleteShader(_id);
+		_id = 0;
+	}
+}
+
 ShaderProgramHandle::ShaderProgramHandle()
 {
 	_id = glCreateProgram();
@@ -226,6 +243,7 @@ ShaderProgramHandle::~ShaderProgramHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_program(_id);
 		glDeleteProgram(_id);
 		_id = 0;
 	}
@@ -240,6 +258,7 @@ BufferHandle::~BufferHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_buffer(_id);
 		glDeleteBuffers(1, &_id);
 		_id = 0;
 	}
@@ -254,6 +273,7 @@ Texture2DHandle::~Texture2DHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_texture(_id);
 		glDeleteTextures(1, &_id);
 		_id = 0;
 	}
@@ -268,11 +288,27 @@ ArrayTexture2DHandle::~ArrayTexture2DHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_texture(_id);
 		glDeleteTextures(1, &_id);
 		_id = 0;
 	}
 }
 
+ProgramPipelineHandle::ProgramPipelineHandle()
+{
+	glCreateProgramPipelines(1, &_id);
+}
+
+ProgramPipelineHandle::~ProgramPipelineHandle()
+{
+	if (_id)
+	{
+		StateCache::get().forget_program_pipeline(_id);
+		glDeleteProgramPipelines(1, &_id);
+		_id = 0;
+	}
+}
+
 MeshHandle::MeshHandle()
 {
 	glCreateVertexArrays(1, &_id);
@@ -282,6 +318,7 @@ MeshHandle::~MeshHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_vertex_array(_id);
 		glDeleteVertexArrays(1, &_id);
 		_id = 0;
 	}
@@ -296,6 +333,7 @@ FramebufferHandle::~FramebufferHandle()
 {
 	if (_id)
 	{
+		StateCache::get().forget_framebuffer(_id);
 		glDeleteFramebuffers(1, &_id);
 		_id = 0;
 	}
@@ -315,23 +353,38 @@ RenderbufferHandle::~RenderbufferHandle()
 	}
 }
 
+static auto shader_info_log(std::uint32_t id) -> std::string
+{
+	GLint length = 0;
+	glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+	std::string message(length, '\0');
+	glGetShaderInfoLog(id, length, &length, message.data());
+	message.resize(length);
+	return message;
+}
+
+static auto program_info_log(std::uint32_t id) -> std::string
+{
+	GLint length = 0;
+	glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+	std::string message(length, '\0');
+	glGetProgramInfoLog(id, length, &length, message.data());
+	message.resize(length);
+	return message;
+}
+
 static void compile_shader(std::uint32_t id, std::string_view contents)
 {
 	const char* contents_cstr = contents.data();
-	glShaderSource(id, 1, &contents_cstr, nullptr);
+	const GLint length = contents.size();
+	glShaderSource(id, 1, &contents_cstr, &length);
 	glCompileShader(id);
 
 	GLint is_compiled = 0;
 	glGetShaderiv(id, GL_COMPILE_STATUS, &is_compiled);
 	if (!is_compiled)
 	{
-		GLint length = 0;
-		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
-		auto message = std::make_unique<char[]>(length);
-		glGetShaderInfoLog(id, length, &length, message.get());
-
-		auto view = std::string_view(message.get(), length);
-		Logger::get().error({"Shader compilation failed:\n{}"}, view);
+		Logger::get().error({"Shader compilation failed:\n{}"}, shader_info_log(id));
 		throw ShaderException();
 	}
 }
@@ -401,228 +454,1176 @@ auto ComputeShader::id() const noexcept -> std::uint32_t
 	return handle.id();
 }
 
+auto compile(const ShaderSource& source) -> Shader
+{
+	switch (source.stage)
+	{
+	case ShaderStage::vertex:
+		return VertexShader(source.source);
+	case ShaderStage::geometry:
+		return GeometryShader(source.source);
+	case ShaderStage::tess_control:
+		return TessControlShader(source.source);
+	case ShaderStage::tess_evaluation:
+		return TessEvaluationShader(source.source);
+	case ShaderStage::fragment:
+		return FragmentShader(source.source);
+	case ShaderStage::compute:
+		return ComputeShader(source.source);
+	}
+
+	Logger::get().error({"Unknown shader stage {}"}, to_underlying(source.stage));
+	throw ShaderException();
+}
+
+auto shader_id(const Shader& shader) noexcept -> std::uint32_t
+{
+	return std::visit([](const auto& s)
+	{
+		return s.id();
+	}, shader);
+}
+
 void ensure_linkage(std::uint32_t program)
 {
 	GLint is_linked = 0;
 	glGetProgramiv(program, GL_LINK_STATUS, &is_linked);
 	if (!is_linked)
+	{
+		Logger::get().error({"Shader linkage failed:\n{}"}, program_info_log(program));
+		throw ShaderException();
+	}
+}
+
+static auto shader_ids(const ShaderVec& shaders) -> std::vector<std::uint32_t>
+{
+	std::vector<std::uint32_t> ids;
+	for (const auto& shader : shaders.impl)
+		ids.push_back(shader_id(shader));
+	return ids;
+}
+
+ShaderProgram::ShaderProgram(const ShaderVec& shaders, bool retrievable)
+: ShaderProgram(shader_ids(shaders), retrievable)
+{
+}
+
+ShaderProgram::ShaderProgram(const VertexShader& vert, const FragmentShader& frag)
+{
+	glAttachShader(handle.id(), vert.id());
+	glAttachShader(handle.id(), frag.id());
+	glLinkProgram(handle.id());
+	glDetachShader(handle.id(), vert.id());
+	glDetachShader(handle.id(), frag.id());
+
+	ensure_linkage(handle.id());
+	reflect();
+}
+
+ShaderProgram::ShaderProgram(gsl::span<const std::uint32_t> shaders, bool retrievable)
+{
+	if (retrievable)
+		glProgramParameteri(handle.id(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	for (auto shader : shaders)
+		glAttachShader(handle.id(), shader);
+
+	glLinkProgram(handle.id());
+
+	for (auto shader : shaders)
+		glDetachShader(handle.id(), shader);
+
+	ensure_linkage(handle.id());
+	reflect();
+}
+
+ShaderProgram::ShaderProgram(const ProgramBinary& binary)
+{
+	glProgramBinary(handle.id(), binary.format, binary.data.data(), binary.data.size());
+
+	GLint is_linked = 0;
+	glGetProgramiv(handle.id(), GL_LINK_STATUS, &is_linked);
+	if (!is_linked)
+	{
+		Logger::get().warn({"Program binary rejected by the driver"});
+		throw ShaderException();
+	}
+
+	reflect();
+}
+
+ShaderProgram::ShaderProgram(ShaderProgramHandle&& __handle)
+: handle(std::move(__handle))
+{
+	reflect();
+}
+
+template <class T, class V>
+struct alternative_index;
+
+template <class T, class ... Ts>
+struct alternative_index<T, std::variant<Ts...>>
+{
+	static constexpr std::size_t value = []
+	{
+		constexpr bool same[] = { std::is_same_v<T, Ts>... };
+		std::size_t index = 0;
+		while (index < sizeof...(Ts) && !same[index])
+			++index;
+		return index;
+	}();
+};
+
+template <class T>
+auto ShaderProgram::update_shadow(std::uint32_t location, const T& value) -> bool
+{
+	// bytes alone can't tell an int from a float or unsigned with the same bits
+	constexpr std::size_t type = alternative_index<T, UniformValue>::value;
+	static_assert(type < std::variant_size_v<UniformValue>);
+	static_assert(sizeof(T) <= sizeof(UniformShadow::value));
+
+	if (location >= shadow.size())
+		shadow.resize(location + 1);
+
+	auto& entry = shadow[location];
+	if (entry.type == type && std::memcmp(entry.value.data(), &value, sizeof(T)) == 0)
+	{
+		++_redundant_uniforms;
+		return false;
+	}
+
+	std::memcpy(entry.value.data(), &value, sizeof(T));
+	entry.type = type;
+	return true;
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, int value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform1i(handle.id(), location, value);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, unsigned value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform1ui(handle.id(), location, value);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, float value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform1f(handle.id(), location, value);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, double value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform1d(handle.id(), location, value);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, glm::vec2 value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform2f(handle.id(), location, value.x, value.y);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, glm::vec3 value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform3f(handle.id(), location, value.x, value.y, value.z);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, glm::vec4 value)
+{
+	if (update_shadow(location, value))
+		glProgramUniform4f(handle.id(), location, value.x, value.y, value.z, value.w);
+}
+
+void ShaderProgram::set_uniform(std::uint32_t location, const glm::mat4& value)
+{
+	if (update_shadow(location, value))
+		glProgramUniformMatrix4fv(handle.id(), location, 1, false, &value[0][0]);
+}
+
+void ShaderProgram::set_uniforms(std::initializer_list<std::pair<std::string_view, UniformValue>> values)
+{
+	for (const auto& [name, value] : values)
+	{
+		const auto uniform = location(name);
+		if (uniform < 0)
+			continue;
+
+		std::visit([this, uniform](const auto& v)
+		{
+			set_uniform(static_cast<std::uint32_t>(uniform), v);
+		}, value);
+	}
+}
+
+void ShaderProgram::bind() const
+{
+	StateCache::get().use_program(handle.id());
+}
+
+auto ShaderProgram::location(std::string_view name) const -> std::int32_t
+{
+	// arrays are stored without their [0] suffix
+	constexpr std::string_view first_element = "[0]";
+	if (name.size() > first_element.size() && name.substr(name.size() - first_element.size()) == first_element)
+		name.remove_suffix(first_element.size());
+
+	const auto it = std::lower_bound(_uniforms.begin(), _uniforms.end(), name,
+		[](const UniformInfo& uniform, std::string_view name)
+		{
+			return uniform.name < name;
+		});
+
+	if (it != _uniforms.end() && it->name == name)
+		return it->location;
+
+	// other array elements are not reflected, ask the driver
+	if (name.find('[') != std::string_view::npos)
+		return glGetProgramResourceLocation(handle.id(), GL_UNIFORM, std::string(name).c_str());
+
+	return -1;
+}
+
+auto ShaderProgram::uniforms() const noexcept -> const std::vector<UniformInfo>&
+{
+	return _uniforms;
+}
+
+auto ShaderProgram::uniform_blocks() const noexcept -> const std::vector<BlockInfo>&
+{
+	return _uniform_blocks;
+}
+
+auto ShaderProgram::storage_blocks() const noexcept -> const std::vector<BlockInfo>&
+{
+	return _storage_blocks;
+}
+
+static auto find_block(const std::vector<BlockInfo>& blocks, std::string_view name) noexcept -> const BlockInfo*
+{
+	const auto it = std::find_if(blocks.begin(), blocks.end(), [name](const BlockInfo& block)
+	{
+		return block.name == name;
+	});
+
+	return it != blocks.end() ? &*it : nullptr;
+}
+
+auto ShaderProgram::uniform_block(std::string_view name) const noexcept -> const BlockInfo*
+{
+	return find_block(_uniform_blocks, name);
+}
+
+auto ShaderProgram::storage_block(std::string_view name) const noexcept -> const BlockInfo*
+{
+	return find_block(_storage_blocks, name);
+}
+
+auto ShaderProgram::redundant_uniforms() const noexcept -> std::size_t
+{
+	return _redundant_uniforms;
+}
+
+static auto resource_name(std::uint32_t program, GLenum interface, GLuint index, GLint length) -> std::string
+{
+	std::string name(std::max(length, 1), '\0');
+	glGetProgramResourceName(program, interface, index, name.size(), &length, name.data());
+	name.resize(length);
+	return name;
+}
+
+static auto reflect_blocks(std::uint32_t program, GLenum interface) -> std::vector<BlockInfo>
+{
+	GLint count = 0;
+	glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &count);
+
+	std::vector<BlockInfo> blocks;
+	const GLenum properties[] = {GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE};
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLint values[3] = {};
+		glGetProgramResourceiv(program, interface, i, 3, properties, 3, nullptr, values);
+		blocks.push_back({resource_name(program, interface, i, values[0]),
+			static_cast<std::uint32_t>(i),
+			static_cast<std::uint32_t>(values[1]),
+			static_cast<std::size_t>(values[2])});
+	}
+
+	return blocks;
+}
+
+void ShaderProgram::reflect()
+{
+	GLint count = 0;
+	glGetProgramInterfaceiv(handle.id(), GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+
+	const GLenum properties[] = {GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_BLOCK_INDEX};
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLint values[5] = {};
+		glGetProgramResourceiv(handle.id(), GL_UNIFORM, i, 5, properties, 5, nullptr, values);
+
+		// block members have no location
+		if (values[4] != -1)
+			continue;
+
+		auto name = resource_name(handle.id(), GL_UNIFORM, i, values[0]);
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			name.resize(name.size() - 3);
+
+		_uniforms.push_back({std::move(name), values[2], static_cast<std::uint32_t>(values[1]), values[3]});
+	}
+
+	std::sort(_uniforms.begin(), _uniforms.end(), [](const UniformInfo& a, const UniformInfo& b)
+	{
+		return a.name < b.name;
+	});
+
+	_uniform_blocks = reflect_blocks(handle.id(), GL_UNIFORM_BLOCK);
+	_storage_blocks = reflect_blocks(handle.id(), GL_SHADER_STORAGE_BLOCK);
+}
+
+auto ShaderProgram::binary() const -> ProgramBinary
+{
+	GLint length = 0;
+	glGetProgramiv(handle.id(), GL_PROGRAM_BINARY_LENGTH, &length);
+
+	ProgramBinary binary;
+	binary.data.resize(length);
+	GLenum format = 0;
+	glGetProgramBinary(handle.id(), length, &length, &format, binary.data.data());
+	binary.data.resize(length);
+	binary.format = format;
+	return binary;
+}
+
+auto ShaderProgram::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+static auto shader_stage(const Shader& shader) noexcept -> ShaderStage
+{
+	constexpr ShaderStage stages[] = {
+		ShaderStage::vertex,
+		ShaderStage::geometry,
+		ShaderStage::tess_control,
+		ShaderStage::tess_evaluation,
+		ShaderStage::fragment,
+		ShaderStage::compute};
+
+	// same order as the Shader alternatives
+	return stages[shader.index()];
+}
+
+static auto stage_bit(ShaderStage stage) noexcept -> GLbitfield
+{
+	switch (stage)
+	{
+	case ShaderStage::vertex:
+		return GL_VERTEX_SHADER_BIT;
+	case ShaderStage::geometry:
+		return GL_GEOMETRY_SHADER_BIT;
+	case ShaderStage::tess_control:
+		return GL_TESS_CONTROL_SHADER_BIT;
+	case ShaderStage::tess_evaluation:
+		return GL_TESS_EVALUATION_SHADER_BIT;
+	case ShaderStage::fragment:
+		return GL_FRAGMENT_SHADER_BIT;
+	case ShaderStage::compute:
+		return GL_COMPUTE_SHADER_BIT;
+	}
+	return 0;
+}
+
+static auto link_separable(const Shader& shader) -> ShaderProgramHandle
+{
+	ShaderProgramHandle handle;
+	glProgramParameteri(handle.id(), GL_PROGRAM_SEPARABLE, GL_TRUE);
+	glAttachShader(handle.id(), shader_id(shader));
+	glLinkProgram(handle.id());
+	glDetachShader(handle.id(), shader_id(shader));
+
+	ensure_linkage(handle.id());
+	return handle;
+}
+
+StageProgram::StageProgram(const ShaderSource& source)
+: ShaderProgram(link_separable(compile(source)))
+, _stage(source.stage)
+{
+}
+
+StageProgram::StageProgram(const Shader& shader)
+: ShaderProgram(link_separable(shader))
+, _stage(shader_stage(shader))
+{
+}
+
+auto StageProgram::stage() const noexcept -> ShaderStage
+{
+	return _stage;
+}
+
+void ProgramPipeline::use(const StageProgram& program)
+{
+	glUseProgramStages(handle.id(), stage_bit(program.stage()), program.id());
+}
+
+void ProgramPipeline::clear(ShaderStage stage)
+{
+	glUseProgramStages(handle.id(), stage_bit(stage), 0);
+}
+
+void ProgramPipeline::bind() const
+{
+	// a bound program takes precedence over the pipeline
+	StateCache::get().use_program(0);
+	StateCache::get().bind_program_pipeline(handle.id());
+}
+
+void ProgramPipeline::validate() const
+{
+	glValidateProgramPipeline(handle.id());
+
+	GLint is_valid = 0;
+	glGetProgramPipelineiv(handle.id(), GL_VALIDATE_STATUS, &is_valid);
+	if (!is_valid)
 	{
 		GLint length = 0;
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-		auto message = std::make_unique<char[]>(length);
-		glGetProgramInfoLog(program, length, &length, message.get());
+		glGetProgramPipelineiv(handle.id(), GL_INFO_LOG_LENGTH, &length);
+		std::string message(length, '\0');
+		glGetProgramPipelineInfoLog(handle.id(), length, &length, message.data());
+		message.resize(length);
 
-		auto view = std::string_view(message.get(), length);
-		Logger::get().error({"Shader linkage failed:\n{}"}, view);
+		Logger::get().error({"Program pipeline validation failed:\n{}"}, message);
 		throw ShaderException();
 	}
 }
 
-ShaderProgram::ShaderProgram(const ShaderVec& shaders)
+auto ProgramPipeline::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+ProgramBuilder::ProgramBuilder(std::uint32_t threads)
+{
+	// 0xFFFFFFFF asks for the implementation's maximum
+	const GLuint count = threads ? threads : 0xFFFFFFFF;
+	if (GLAD_GL_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(count);
+	else if (GLAD_GL_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(count);
+}
+
+void ProgramBuilder::build(const std::vector<ShaderSource>& sources, Callback callback)
+{
+	submit(sources, std::move(callback), nullptr);
+}
+
+auto ProgramBuilder::build_future(const std::vector<ShaderSource>& sources) -> std::future<ShaderProgram>
+{
+	auto promise = std::make_shared<std::promise<ShaderProgram>>();
+	auto future = promise->get_future();
+	submit(sources, [promise](ShaderProgram&& program)
+	{
+		promise->set_value(std::move(program));
+	}, [promise]()
+	{
+		promise->set_exception(std::make_exception_ptr(ShaderException()));
+	});
+	return future;
+}
+
+void ProgramBuilder::submit(const std::vector<ShaderSource>& sources, Callback callback, std::function<void()> failed)
+{
+	Job job {ShaderProgramHandle(), {}, std::move(callback), std::move(failed)};
+
+	// No status queries here, they would wait for the driver
+	for (const auto& source : sources)
+	{
+		auto& shader = job.shaders.emplace_back(to_underlying(source.stage));
+		const char* contents = source.source.data();
+		const GLint length = source.source.size();
+		glShaderSource(shader.id(), 1, &contents, &length);
+		glCompileShader(shader.id());
+		glAttachShader(job.program.id(), shader.id());
+	}
+
+	glLinkProgram(job.program.id());
+	jobs.push_back(std::move(job));
+}
+
+void ProgramBuilder::poll()
+{
+	const bool parallel = supports_parallel_compile();
+	std::list<Job> done;
+
+	for (auto it = jobs.begin(); it != jobs.end();)
+	{
+		GLint is_complete = GL_FALSE;
+		if (parallel)
+			glGetProgramiv(it->program.id(), GL_COMPLETION_STATUS_KHR, &is_complete);
+		else
+			is_complete = done.empty();
+
+		if (is_complete)
+			done.splice(done.end(), jobs, it++);
+		else
+			++it;
+	}
+
+	// callbacks may queue new builds
+	for (auto& job : done)
+		complete(job);
+}
+
+void ProgramBuilder::finish()
+{
+	while (!jobs.empty())
+	{
+		std::list<Job> done;
+		done.swap(jobs);
+		for (auto& job : done)
+			complete(job);
+	}
+}
+
+auto ProgramBuilder::pending() const noexcept -> std::size_t
+{
+	return jobs.size();
+}
+
+auto ProgramBuilder::failures() const noexcept -> std::size_t
+{
+	return _failures;
+}
+
+void ProgramBuilder::complete(Job& job)
+{
+	GLint is_linked = 0;
+	glGetProgramiv(job.program.id(), GL_LINK_STATUS, &is_linked);
+
+	for (const auto& shader : job.shaders)
+		glDetachShader(job.program.id(), shader.id());
+
+	if (is_linked)
+	{
+		job.callback(ShaderProgram(std::move(job.program)));
+		return;
+	}
+
+	for (const auto& shader : job.shaders)
+	{
+		GLint is_compiled = 0;
+		glGetShaderiv(shader.id(), GL_COMPILE_STATUS, &is_compiled);
+		if (!is_compiled)
+			Logger::get().error({"Shader compilation failed:\n{}"}, shader_info_log(shader.id()));
+	}
+
+	Logger::get().error({"Shader linkage failed:\n{}"}, program_info_log(job.program.id()));
+	++_failures;
+	if (job.failed)
+		job.failed();
+}
+
+FenceSync::FenceSync()
+{
+	handle = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+FenceSync::FenceSync(FenceSync&& other) noexcept
+{
+	handle = other.handle;
+	other.handle = nullptr;
+}
+
+FenceSync::~FenceSync()
+{
+	if (handle)
+		glDeleteSync(handle);
+}
+
+void FenceSync::resubmit()
+{
+	glDeleteSync(handle);
+	handle = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool FenceSync::is_ready() const
+{
+	auto res = glClientWaitSync(handle, 0, 0);
+	return res == GL_CONDITION_SATISFIED || res == GL_ALREADY_SIGNALED;
+}
+
+BufferBase::BufferBase(gsl::span<const std::byte> buffer)
+: _size_bytes(buffer.size_bytes())
+{
+	glNamedBufferStorage(handle.id(), _size_bytes, buffer.data(), 0);
+}
+
+void BufferBase::bind_to_uniform(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_UNIFORM_BUFFER, index, handle.id());
+}
+
+void BufferBase::bind_to_storage(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, index, handle.id());
+}
+
+auto BufferBase::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+auto BufferBase::size_bytes() const noexcept -> std::size_t
+{
+	return _size_bytes;
+}
+
+DynamicBufferBase::DynamicBufferBase(gsl::span<const std::byte> buffer)
+: shadow(buffer.begin(), buffer.end())
+{
+	glNamedBufferStorage(handle.id(), shadow.size(), shadow.data(), GL_DYNAMIC_STORAGE_BIT);
+}
+
+void DynamicBufferBase::write(std::size_t offset, gsl::span<const std::byte> data)
+{
+	mark_dirty(offset, data.size());
+	std::copy(data.begin(), data.end(), shadow.begin() + offset);
+}
+
+void DynamicBufferBase::check_elements(std::size_t first, std::size_t count, std::size_t element_size) const
+{
+	const std::size_t elements = shadow.size() / element_size;
+	if (first > elements || count > elements - first)
+	{
+		Logger::get().error({"Dynamic buffer elements [{:d}, {:d}) exceed buffer size {:d}"},
+				first, first + count, elements);
+		throw BufferException();
+	}
+}
+
+void DynamicBufferBase::mark_dirty(std::size_t offset, std::size_t size)
+{
+	if (offset > shadow.size() || size > shadow.size() - offset)
+	{
+		Logger::get().error({"Dynamic buffer range [{:d}, {:d}) exceeds buffer size {:d}"},
+				offset, offset + size, shadow.size());
+		throw BufferException();
+	}
+
+	if (size == 0)
+		return;
+
+	// extend the last range when writes are sequential
+	if (!dirty.empty()
+		&& offset >= dirty.back().first
+		&& offset <= dirty.back().second)
+	{
+		dirty.back().second = std::max(dirty.back().second, offset + size);
+		return;
+	}
+
+	dirty.emplace_back(offset, offset + size);
+}
+
+void DynamicBufferBase::flush()
+{
+	if (dirty.empty())
+		return;
+
+	std::sort(dirty.begin(), dirty.end());
+
+	// merge overlapping and adjacent ranges
+	auto range = dirty.front();
+	auto upload = [this](std::pair<std::size_t, std::size_t> r)
+	{
+		glNamedBufferSubData(handle.id(), r.first, r.second - r.first, shadow.data() + r.first);
+	};
+
+	for (std::size_t i = 1; i < dirty.size(); ++i)
+	{
+		if (dirty[i].first <= range.second)
+		{
+			range.second = std::max(range.second, dirty[i].second);
+		}
+		else
+		{
+			upload(range);
+			range = dirty[i];
+		}
+	}
+
+	upload(range);
+	dirty.clear();
+}
+
+void DynamicBufferBase::bind_to_uniform(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_UNIFORM_BUFFER, index, handle.id());
+}
+
+void DynamicBufferBase::bind_to_storage(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, index, handle.id());
+}
+
+auto DynamicBufferBase::data() const noexcept -> gsl::span<const std::byte>
+{
+	return shadow;
+}
+
+auto DynamicBufferBase::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+auto DynamicBufferBase::size_bytes() const noexcept -> std::size_t
+{
+	return shadow.size();
+}
+
+auto DynamicBufferBase::shadow_span() noexcept -> gsl::span<std::byte>
+{
+	return shadow;
+}
+
+BufferStreamBase::BufferStreamBase(std::size_t size_bytes, StreamMode mode)
+: _mode(mode)
+{
+	GLenum storage_flags = GL_MAP_PERSISTENT_BIT | GL_MAP_WRITE_BIT;
+	GLenum map_flags = GL_MAP_PERSISTENT_BIT | GL_MAP_WRITE_BIT;
+
+	if (mode == StreamMode::coherent)
+	{
+		storage_flags |= GL_MAP_COHERENT_BIT;
+		map_flags |= GL_MAP_COHERENT_BIT;
+	}
+	else if (mode == StreamMode::explicit_flush)
+	{
+		map_flags |= GL_MAP_FLUSH_EXPLICIT_BIT;
+	}
+
+	size_bytes *= slots();
+	glNamedBufferStorage(handle.id(), size_bytes, nullptr, storage_flags);
+	auto data = (std::byte*) glMapNamedBufferRange(handle.id(), 0, size_bytes, map_flags);
+	buffer = { data, size_bytes };
+	slot = 0;
+}
+
+auto BufferStreamBase::begin_write() -> BufferStreamWriter<std::byte>
+{
+	return BufferStreamWriter<std::byte>(*this);
+}
+
+void BufferStreamBase::bind_to_uniform(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_UNIFORM_BUFFER, index, handle.id(), slot * size_bytes(), size_bytes());
+}
+
+void BufferStreamBase::bind_to_storage(std::size_t index) const
+{
+	StateCache::get().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, index, handle.id(), slot * size_bytes(), size_bytes());
+}
+
+auto BufferStreamBase::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+auto BufferStreamBase::current_slot() const noexcept -> std::size_t
+{
+	return slot;
+}
+
+auto BufferStreamBase::slots() const noexcept -> std::size_t
+{
+	return fences.size();
+}
+
+auto BufferStreamBase::size_bytes() const noexcept -> std::size_t
+{
+	return buffer.size() / slots();
+}
+
+auto BufferStreamBase::mode() const noexcept -> StreamMode
+{
+	return _mode;
+}
+
+void BufferStreamBase::write_lock_acquire()
+{
+	slot = (slot + 1) % slots();
+	while (!fences[slot].is_ready());
+}
+
+void BufferStreamBase::write_lock_release()
+{
+	switch (_mode)
+	{
+	case StreamMode::barrier:
+		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+		break;
+	case StreamMode::explicit_flush:
+		if (written.empty())
+			written.emplace_back(0, size_bytes());
+		for (const auto& [begin, end] : written)
+			glFlushMappedNamedBufferRange(handle.id(), slot * size_bytes() + begin, end - begin);
+		written.clear();
+		break;
+	case StreamMode::coherent:
+		break;
+	}
+
+	fences[slot].resubmit();
+}
+
+void BufferStreamBase::mark_written(std::size_t offset, std::size_t size)
+{
+	if (_mode != StreamMode::explicit_flush || size == 0)
+		return;
+
+	// extend the last range when writes are sequential
+	if (!written.empty()
+		&& offset >= written.back().first
+		&& offset <= written.back().second)
+	{
+		written.back().second = std::max(written.back().second, offset + size);
+		return;
+	}
+
+	written.emplace_back(offset, offset + size);
+}
+
+auto BufferStreamBase::slot_span() const noexcept -> gsl::span<std::byte>
+{
+	return buffer.subspan(slot * size_bytes(), size_bytes());
+}
+
+BufferException::BufferException()
+: std::runtime_error("Buffer exception")
+{
+}
+
+static auto align_up(std::size_t offset, std::size_t alignment) noexcept -> std::size_t
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+TransientBuffer::TransientBuffer(std::size_t size_bytes)
+{
+	const GLenum flags = GL_MAP_PERSISTENT_BIT | GL_MAP_WRITE_BIT | GL_MAP_COHERENT_BIT;
+
+	glNamedBufferStorage(handle.id(), size_bytes, nullptr, flags);
+	auto data = (std::byte*) glMapNamedBufferRange(handle.id(), 0, size_bytes, flags);
+	buffer = { data, size_bytes };
+	frame_ends.fill(npos);
+
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	_uniform_alignment = std::max(alignment, 1);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	_storage_alignment = std::max(alignment, 1);
+}
+
+auto TransientBuffer::allocate(std::size_t size_bytes, std::size_t alignment) -> TransientAllocation
 {
-	auto attach_shader = [this](const auto& shader)
+	if (size_bytes > buffer.size())
 	{
-		glAttachShader(handle.id(), shader.id());
-	};
+		Logger::get().error({"Transient allocation of {:d} bytes exceeds buffer size {:d}"},
+				size_bytes, buffer.size());
+		throw BufferException();
+	}
 
-	auto detach_shader = [this](const auto& shader)
+	while (true)
 	{
-		glDetachShader(handle.id(), shader.id());
-	};
-
-	for (const auto& shader : shaders.impl)
-		std::visit(attach_shader, shader);
+		// ring is empty, restart from the front
+		// frames in flight allocated nothing past the tail, so they end at the new front too
+		if (head == tail)
+		{
+			for (auto& end : frame_ends)
+			{
+				if (end != npos)
+					end = 0;
+			}
+			head = tail = 0;
+		}
 
-	glLinkProgram(handle.id());
+		std::size_t offset = align_up(head, alignment);
+		if (head >= tail && offset + size_bytes <= buffer.size())
+		{
+			head = offset + size_bytes;
+			return { buffer.subspan(offset, size_bytes), offset };
+		}
 
-	for (const auto& shader : shaders.impl)
-		std::visit(detach_shader, shader);
+		// wrap around, must stay strictly behind the tail
+		if (head >= tail)
+			offset = 0;
+		if (offset < tail && offset + size_bytes < tail)
+		{
+			head = offset + size_bytes;
+			return { buffer.subspan(offset, size_bytes), offset };
+		}
 
-	ensure_linkage(handle.id());
+		// stall until an in flight frame frees its space
+		if (!reclaim_oldest())
+		{
+			Logger::get().error({"Transient buffer of {:d} bytes exhausted within a single frame"},
+					buffer.size());
+			throw BufferException();
+		}
+	}
 }
 
-ShaderProgram::ShaderProgram(const VertexShader& vert, const FragmentShader& frag)
+auto TransientBuffer::allocate_uniform(std::size_t size_bytes) -> TransientAllocation
 {
-	glAttachShader(handle.id(), vert.id());
-	glAttachShader(handle.id(), frag.id());
-	glLinkProgram(handle.id());
-	glDetachShader(handle.id(), vert.id());
-	glDetachShader(handle.id(), frag.id());
-
-	ensure_linkage(handle.id());
+	return allocate(size_bytes, _uniform_alignment);
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, int value)
+auto TransientBuffer::allocate_storage(std::size_t size_bytes) -> TransientAllocation
 {
-	glProgramUniform1i(handle.id(), location, value);
+	return allocate(size_bytes, _storage_alignment);
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, unsigned value)
+void TransientBuffer::end_frame()
 {
-	glProgramUniform1ui(handle.id(), location, value);
+	fences[frame].resubmit();
+	frame_ends[frame] = head;
+	frame = (frame + 1) % fences.size();
+	reclaim(frame);
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, float value)
+void TransientBuffer::bind_to_uniform(std::size_t index, const TransientAllocation& allocation) const
 {
-	glProgramUniform1f(handle.id(), location, value);
+	StateCache::get().bind_buffer_range(GL_UNIFORM_BUFFER, index, handle.id(), allocation.offset, allocation.data.size());
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, double value)
+void TransientBuffer::bind_to_storage(std::size_t index, const TransientAllocation& allocation) const
 {
-	glProgramUniform1d(handle.id(), location, value);
+	StateCache::get().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, index, handle.id(), allocation.offset, allocation.data.size());
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, glm::vec2 value)
+auto TransientBuffer::id() const noexcept -> std::uint32_t
 {
-	glProgramUniform2f(handle.id(), location, value.x, value.y);
+	return handle.id();
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, glm::vec3 value)
+auto TransientBuffer::size_bytes() const noexcept -> std::size_t
 {
-	glProgramUniform3f(handle.id(), location, value.x, value.y, value.z);
+	return buffer.size();
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, glm::vec4 value)
+auto TransientBuffer::uniform_alignment() const noexcept -> std::size_t
 {
-	glProgramUniform4f(handle.id(), location, value.x, value.y, value.z, value.w);
+	return _uniform_alignment;
 }
 
-void ShaderProgram::set_uniform(std::uint32_t location, const glm::mat4& value)
+auto TransientBuffer::storage_alignment() const noexcept -> std::size_t
 {
-	glProgramUniformMatrix4fv(handle.id(), location, 1, false, &value[0][0]);
+	return _storage_alignment;
 }
 
-void ShaderProgram::bind() const
+void TransientBuffer::reclaim(std::size_t index)
 {
-	glUseProgram(handle.id());
+	if (frame_ends[index] == npos)
+		return;
+
+	while (!fences[index].is_ready());
+	tail = frame_ends[index];
+	frame_ends[index] = npos;
 }
 
-FenceSync::FenceSync()
+bool TransientBuffer::reclaim_oldest()
 {
-	handle = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	// frames in flight, from oldest to newest
+	for (std::size_t i = 1; i < fences.size(); ++i)
+	{
+		std::size_t index = (frame + i) % fences.size();
+		if (frame_ends[index] != npos)
+		{
+			reclaim(index);
+			return true;
+		}
+	}
+	return false;
 }
 
-FenceSync::FenceSync(FenceSync&& other) noexcept
+auto index_size(IndexType type) noexcept -> std::size_t
 {
-	handle = other.handle;
-	other.handle = nullptr;
+	switch (type)
+	{
+	case IndexType::u8:
+		return sizeof(std::uint8_t);
+	case IndexType::u16:
+		return sizeof(std::uint16_t);
+	case IndexType::u32:
+		return sizeof(std::uint32_t);
+	default: assert(false); return 0;
+	}
 }
 
-FenceSync::~FenceSync()
+auto smallest_index_type(const std::vector<std::uint32_t>& indices) noexcept -> IndexType
 {
-	if (handle)
-		glDeleteSync(handle);
+	// 8 bit indices are emulated on most hardware, never pick them implicitly
+	auto max = std::max_element(indices.begin(), indices.end());
+	if (max == indices.end() || *max <= std::numeric_limits<std::uint16_t>::max())
+		return IndexType::u16;
+	return IndexType::u32;
 }
 
-void FenceSync::resubmit()
+template <class T>
+static auto pack_indices_as(const std::vector<std::uint32_t>& indices) -> std::vector<std::byte>
 {
-	glDeleteSync(handle);
-	handle = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	std::vector<std::byte> bytes(indices.size() * sizeof(T));
+	auto packed = reinterpret_cast<T*>(bytes.data());
+
+	for (std::size_t i = 0; i < indices.size(); ++i)
+	{
+		if (indices[i] > std::numeric_limits<T>::max())
+		{
+			Logger::get().error({"Index {:d} does not fit in {:d} bytes"}, indices[i], sizeof(T));
+			throw BufferException();
+		}
+		packed[i] = static_cast<T>(indices[i]);
+	}
+
+	return bytes;
 }
 
-bool FenceSync::is_ready() const
+auto pack_indices(const std::vector<std::uint32_t>& indices, IndexType type) -> std::vector<std::byte>
 {
-	auto res = glClientWaitSync(handle, 0, 0);
-	return res == GL_CONDITION_SATISFIED || res == GL_ALREADY_SIGNALED;
+	switch (type)
+	{
+	case IndexType::u8:
+		return pack_indices_as<std::uint8_t>(indices);
+	case IndexType::u16:
+		return pack_indices_as<std::uint16_t>(indices);
+	default:
+		return pack_indices_as<std::uint32_t>(indices);
+	}
 }
 
-BufferBase::BufferBase(gsl::span<const std::byte> buffer)
-: _size_bytes(buffer.size_bytes())
+IndexBuffer::IndexBuffer(const std::vector<std::uint32_t>& indices)
+: IndexBuffer(indices, smallest_index_type(indices))
 {
-	glNamedBufferStorage(handle.id(), _size_bytes, buffer.data(), 0);
 }
 
-void BufferBase::bind_to_uniform(std::size_t index) const
+IndexBuffer::IndexBuffer(const std::vector<std::uint32_t>& indices, IndexType type)
+: BufferBase(pack_indices(indices, type))
+, _type(type)
 {
-	glBindBufferBase(GL_UNIFORM_BUFFER, index, handle.id());
 }
 
-void BufferBase::bind_to_storage(std::size_t index) const
+IndexBuffer::IndexBuffer(gsl::span<const std::uint16_t> indices)
+: BufferBase(gsl::as_bytes(indices))
+, _type(IndexType::u16)
 {
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, handle.id());
 }
 
-auto BufferBase::id() const noexcept -> std::uint32_t
+IndexBuffer::IndexBuffer(gsl::span<const std::uint8_t> indices)
+: BufferBase(gsl::as_bytes(indices))
+, _type(IndexType::u8)
 {
-	return handle.id();
 }
 
-auto BufferBase::size_bytes() const noexcept -> std::size_t
+IndexBuffer::IndexBuffer(gsl::span<const std::byte> indices, IndexType type)
+: BufferBase(indices)
+, _type(type)
 {
-	return _size_bytes;
 }
 
-BufferStreamBase::BufferStreamBase(std::size_t size_bytes)
+auto IndexBuffer::type() const noexcept -> IndexType
 {
-	const GLenum flags = GL_MAP_PERSISTENT_BIT | GL_MAP_WRITE_BIT;
-
-	size_bytes *= slots();
-	glNamedBufferStorage(handle.id(), size_bytes, nullptr, flags);
-	auto data = (std::byte*) glMapNamedBufferRange(handle.id(), 0, size_bytes, flags);
-	buffer = { data, size_bytes };
-	slot = 0;
+	return _type;
 }
 
-void BufferStreamBase::update(std::function<void(gsl::span<std::byte>)> f)
+auto IndexBuffer::size() const noexcept -> std::size_t
 {
-	write_lock_acquire();
-	f(slot_span());
-	write_lock_release();
+	return size_bytes() / index_size(_type);
 }
 
-void BufferStreamBase::bind_to_uniform(std::size_t index) const
+BufferPoolBase::BufferPoolBase(std::size_t __element_size, std::size_t capacity)
+: element_size(__element_size)
+, allocator(capacity)
 {
-	glBindBufferRange(GL_UNIFORM_BUFFER,
-	 	index,
-	 	handle.id(),
-	 	slot * size_bytes(),
-		size_bytes());
+	reallocate(capacity, {});
 }
 
-void BufferStreamBase::bind_to_storage(std::size_t index) const
+auto BufferPoolBase::allocate(gsl::span<const std::byte> data) -> std::uint32_t
 {
-	glBindBufferRange(GL_SHADER_STORAGE_BUFFER,
-	 	index,
-	 	handle.id(),
-	 	slot * size_bytes(),
-		size_bytes());
+	const std::size_t count = data.size() / element_size;
+
+	auto range = allocator.allocate(count);
+	if (range == RangeAllocator::invalid)
+	{
+		const std::size_t old_capacity = allocator.capacity();
+		const std::size_t capacity = std::max(old_capacity * 2, old_capacity + count);
+		allocator.grow(capacity);
+		reallocate(capacity, {{0, 0, old_capacity}});
+		range = allocator.allocate(count);
+	}
+
+	glNamedBufferSubData(handle->id(),
+		allocator.offset(range) * element_size,
+		data.size(),
+		data.data());
+	return range;
 }
 
-auto BufferStreamBase::id() const noexcept -> std::uint32_t
+void BufferPoolBase::free(std::uint32_t range)
 {
-	return handle.id();
+	allocator.free(range);
 }
 
-auto BufferStreamBase::current_slot() const noexcept -> std::size_t
+void BufferPoolBase::defragment()
 {
-	return slot;
+	reallocate(allocator.capacity(), allocator.defragment());
 }
 
-auto BufferStreamBase::slots() const noexcept -> std::size_t
+auto BufferPoolBase::offset(std::uint32_t range) const noexcept -> std::size_t
 {
-	return fences.size();
+	return allocator.offset(range);
 }
 
-auto BufferStreamBase::size_bytes() const noexcept -> std::size_t
+auto BufferPoolBase::size(std::uint32_t range) const noexcept -> std::size_t
 {
-	return buffer.size() / slots();
+	return allocator.size(range);
 }
 
-void BufferStreamBase::write_lock_acquire()
+auto BufferPoolBase::capacity() const noexcept -> std::size_t
 {
-	slot = (slot + 1) % slots();
-	while (!fences[slot].is_ready());
+	return allocator.capacity();
 }
 
-void BufferStreamBase::write_lock_release()
+auto BufferPoolBase::id() const noexcept -> std::uint32_t
 {
-	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
-	fences[slot].resubmit();
+	return handle->id();
 }
 
-auto BufferStreamBase::slot_span() const noexcept -> gsl::span<std::byte>
+void BufferPoolBase::reallocate(std::size_t capacity, const std::vector<RangeMove>& moves)
 {
-	return buffer.subspan(slot * size_bytes(), size_bytes());
+	auto next = std::make_unique<BufferHandle>();
+	glNamedBufferStorage(next->id(), capacity * element_size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+	for (const auto& move : moves)
+	{
+		if (move.size == 0)
+			continue;
+
+		glCopyNamedBufferSubData(handle->id(),
+			next->id(),
+			move.source * element_size,
+			move.destination * element_size,
+			move.size * element_size);
+	}
+
+	handle = std::move(next);
 }
 
 Texture2D::Texture2D(std::size_t __width, std::size_t __height, InternalFormat internal_format)
@@ -680,7 +1681,7 @@ auto Texture2D::height() const noexcept -> std::size_t
 
 void Texture2D::bind(std::uint32_t unit) const
 {
-	glBindTextureUnit(unit, handle.id());
+	StateCache::get().bind_texture(unit, handle.id());
 }
 
 ArrayTexture2D::ArrayTexture2D(std::size_t __width,
@@ -814,22 +1815,28 @@ auto ArrayTexture2D::layers() const noexcept -> std::size_t
 
 void ArrayTexture2D::bind_to_unit(std::uint32_t unit) const
 {
-	glBindTextureUnit(unit, handle.id());
+	StateCache::get().bind_texture(unit, handle.id());
+}
+
+// Index type of the last mesh bound, kept by the state cache
+static auto bound_index_type() noexcept -> IndexType
+{
+	return static_cast<IndexType>(StateCache::get().index_type());
 }
 
 void MeshBase::attach(const IndexBuffer& indices)
 {
-	glVertexArrayElementBuffer(handle.id(), indices.id());
+	set_index_buffer(indices.id(), indices.type());
 }
 
 void MeshBase::bind() const
 {
-	glBindVertexArray(handle.id());
+	StateCache::get().bind_vertex_array(handle.id(), to_underlying(_index_type));
 }
 
 void MeshBase::unbind() const
 {
-	glBindVertexArray(0);
+	StateCache::get().bind_vertex_array(0);
 }
 
 auto MeshBase::id() const noexcept -> std::uint32_t
@@ -837,18 +1844,40 @@ auto MeshBase::id() const noexcept -> std::uint32_t
 	return handle.id();
 }
 
+auto MeshBase::index_type() const noexcept -> IndexType
+{
+	return _index_type;
+}
+
+void MeshBase::set_index_buffer(std::uint32_t buffer, IndexType type)
+{
+	glVertexArrayElementBuffer(handle.id(), buffer);
+	_index_type = type;
+	StateCache::get().set_index_type(handle.id(), to_underlying(type));
+}
+
 void MeshBase::set_attrib_port(std::uint32_t attrib, std::uint32_t port)
 {
 	glVertexArrayAttribBinding(id(), attrib, port);
 }
 
+void MeshBase::set_port_divisor(std::uint32_t port, std::uint32_t divisor)
+{
+	glVertexArrayBindingDivisor(id(), port, divisor);
+}
+
 void MeshBase::set_attrib_format(std::uint32_t attrib,
 		std::uint32_t type,
 		std::size_t type_count,
+		bool normalized,
+		bool integer,
 		std::size_t type_offset)
 {
 	glEnableVertexArrayAttrib(id(), attrib);
-	glVertexArrayAttribFormat(id(), attrib, type_count, type, false, type_offset);
+	if (integer)
+		glVertexArrayAttribIFormat(id(), attrib, type_count, type, type_offset);
+	else
+		glVertexArrayAttribFormat(id(), attrib, type_count, type, normalized, type_offset);
 }
 
 void MeshBase::set_port_buffer(std::uint32_t port,
@@ -953,7 +1982,258 @@ auto Framebuffer::height() const noexcept -> std::size_t
 
 void Framebuffer::bind() const
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, handle.id());
+	StateCache::get().bind_framebuffer(GL_FRAMEBUFFER, handle.id());
+}
+
+auto Framebuffer::id() const noexcept -> std::uint32_t
+{
+	return handle.id();
+}
+
+Readback::Readback(std::size_t size_bytes)
+{
+	const GLenum flags = GL_MAP_PERSISTENT_BIT | GL_MAP_READ_BIT | GL_MAP_COHERENT_BIT;
+
+	glNamedBufferStorage(handle.id(), size_bytes, nullptr, flags);
+	auto data = (std::byte*) glMapNamedBufferRange(handle.id(), 0, size_bytes, flags);
+	buffer = { data, size_bytes };
+}
+
+void Readback::read(const BufferBase& source, std::size_t offset, std::size_t size, Callback callback)
+{
+	auto destination = allocate(size);
+	glCopyNamedBufferSubData(source.id(), handle.id(), offset, destination, size);
+	submit(destination, size, std::move(callback));
+}
+
+void Readback::read(const Texture2D& texture, const iRect2D& region, ImageFormat format, Callback callback)
+{
+	const std::size_t size = region.width * region.height * num_components(format);
+	auto destination = allocate(size);
+
+	// rows are tightly packed, the alignment stays set for the next read
+	StateCache::get().bind_buffer(GL_PIXEL_PACK_BUFFER, handle.id());
+	StateCache::get().set_pack_alignment(1);
+	glGetTextureSubImage(texture.id(),
+		0,
+		region.position.x,
+		region.position.y,
+		0,
+		region.width,
+		region.height,
+		1,
+		to_underlying(format),
+		GL_UNSIGNED_BYTE,
+		size,
+		(void*) destination);
+	StateCache::get().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	submit(destination, size, std::move(callback));
+}
+
+void Readback::read(const Framebuffer& framebuffer, const iRect2D& region, ImageFormat format, Callback callback)
+{
+	read_pixels(framebuffer.id(), region, format, std::move(callback));
+}
+
+void Readback::read(const iRect2D& region, ImageFormat format, Callback callback)
+{
+	read_pixels(0, region, format, std::move(callback));
+}
+
+void Readback::poll()
+{
+	while (!requests.empty() && requests.front().fence.is_ready())
+		complete_oldest();
+}
+
+void Readback::finish()
+{
+	while (!requests.empty())
+		complete_oldest();
+}
+
+auto Readback::pending() const noexcept -> std::size_t
+{
+	return requests.size();
+}
+
+auto Readback::allocate(std::size_t size) -> std::size_t
+{
+	if (size > buffer.size())
+	{
+		Logger::get().error({"Readback of {:d} bytes exceeds buffer size {:d}"}, size, buffer.size());
+		throw BufferException();
+	}
+
+	while (!requests.empty())
+	{
+		// requests complete in order, so the oldest one bounds the free space
+		const std::size_t tail = requests.front().offset;
+		const std::size_t offset = align_up(head, 4);
+
+		if (tail <= head)
+		{
+			if (offset + size <= buffer.size())
+				return offset;
+			if (size < tail)
+				return 0;
+		}
+		else if (offset + size < tail)
+		{
+			return offset;
+		}
+
+		complete_oldest();
+	}
+
+	return 0;
+}
+
+void Readback::submit(std::size_t offset, std::size_t size, Callback&& callback)
+{
+	head = offset + size;
+	requests.push_back({FenceSync(), offset, size, std::move(callback)});
+}
+
+void Readback::complete_oldest()
+{
+	auto& request = requests.front();
+	if (!request.fence.is_ready())
+	{
+		glFlush();
+		while (!request.fence.is_ready());
+	}
+
+	auto callback = std::move(request.callback);
+	auto data = buffer.subspan(request.offset, request.size);
+	requests.pop_front();
+	callback(data);
+}
+
+void Readback::read_pixels(std::uint32_t framebuffer, const iRect2D& region, ImageFormat format, Callback&& callback)
+{
+	const std::size_t size = region.width * region.height * num_components(format);
+	auto destination = allocate(size);
+
+	// glReadPixels has no named variant, put back what the caller had bound
+	const auto previous = StateCache::get().bound_read_framebuffer();
+
+	StateCache::get().bind_framebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	StateCache::get().bind_buffer(GL_PIXEL_PACK_BUFFER, handle.id());
+	StateCache::get().set_pack_alignment(1);
+	glReadPixels(region.position.x,
+		region.position.y,
+		region.width,
+		region.height,
+		to_underlying(format),
+		GL_UNSIGNED_BYTE,
+		(void*) destination);
+	StateCache::get().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	StateCache::get().bind_framebuffer(GL_READ_FRAMEBUFFER, previous);
+
+	submit(destination, size, std::move(callback));
+}
+
+DrawBatch::DrawBatch(std::size_t capacity)
+: indirect(std::make_unique<ArrayBufferStream<DrawElementsCommand>>(capacity))
+{
+	commands.reserve(capacity);
+}
+
+void DrawBatch::add(const MeshRange& range, std::size_t instances, std::size_t base_instance)
+{
+	DrawElementsCommand command;
+	command.count = range.count;
+	command.instance_count = instances;
+	command.first_index = range.first_index;
+	command.base_vertex = range.base_vertex;
+	command.base_instance = base_instance;
+	commands.push_back(command);
+}
+
+void DrawBatch::clear() noexcept
+{
+	commands.clear();
+}
+
+static void multi_draw_indirect_count(std::size_t offset, std::size_t parameter_offset, std::size_t max_draws)
+{
+	// same entry point, 4.5 drivers only expose the ARB name
+	if (GLAD_GL_VERSION_4_6)
+	{
+		glMultiDrawElementsIndirectCount(GL_TRIANGLES,
+			to_underlying(bound_index_type()),
+			(void*) offset,
+			parameter_offset,
+			max_draws,
+			0);
+	}
+	else
+	{
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES,
+			to_underlying(bound_index_type()),
+			(void*) offset,
+			parameter_offset,
+			max_draws,
+			0);
+	}
+}
+
+void DrawBatch::submit()
+{
+	if (commands.empty())
+		return;
+
+	const auto offset = upload();
+	glMultiDrawElementsIndirect(GL_TRIANGLES,
+		to_underlying(bound_index_type()),
+		(void*) offset,
+		commands.size(),
+		0);
+}
+
+void DrawBatch::submit(const BufferBase& parameters, std::size_t parameter_offset)
+{
+	if (!supports_indirect_count())
+	{
+		submit();
+		return;
+	}
+
+	if (commands.empty())
+		return;
+
+	const auto offset = upload();
+	StateCache::get().bind_buffer(GL_PARAMETER_BUFFER, parameters.id());
+	multi_draw_indirect_count(offset, parameter_offset, commands.size());
+}
+
+auto DrawBatch::upload() -> std::size_t
+{
+	if (commands.size() > indirect->size())
+	{
+		auto capacity = std::max(commands.size(), indirect->size() * 2);
+		indirect = std::make_unique<ArrayBufferStream<DrawElementsCommand>>(capacity);
+	}
+
+	indirect->update([this](gsl::span<DrawElementsCommand> span)
+	{
+		std::copy(commands.begin(), commands.end(), span.begin());
+	});
+
+	StateCache::get().bind_buffer(GL_DRAW_INDIRECT_BUFFER, indirect->id());
+	return indirect->current_slot() * indirect->size_bytes();
+}
+
+auto DrawBatch::size() const noexcept -> std::size_t
+{
+	return commands.size();
+}
+
+auto DrawBatch::capacity() const noexcept -> std::size_t
+{
+	return indirect->size();
 }
 
 void clear(glm::vec4 rgba, float depth)
@@ -964,30 +2244,96 @@ void clear(glm::vec4 rgba, float depth)
 
 void draw_triangles(std::size_t n)
 {
-	glDrawElements(GL_TRIANGLES, n, GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, n, to_underlying(bound_index_type()), 0);
 }
 
 void draw_triangle_strips(std::size_t n)
 {
-	glDrawElements(GL_TRIANGLE_STRIP, n, GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLE_STRIP, n, to_underlying(bound_index_type()), 0);
 }
 
 void draw_triangle_strips_instanced(std::size_t indices, std::size_t instances)
 {
-	glDrawElementsInstanced(GL_TRIANGLE_STRIP, indices, GL_UNSIGNED_INT, 0, instances);
+	glDrawElementsInstanced(GL_TRIANGLE_STRIP, indices, to_underlying(bound_index_type()), 0, instances);
 }
 
-void set_alpha(bool value)
+void draw_triangles_instanced(std::size_t indices, std::size_t instances, std::size_t base_instance)
 {
-	if (value)
-	{
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	}
-	else
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES,
+		indices,
+		to_underlying(bound_index_type()),
+		0,
+		instances,
+		base_instance);
+}
+
+void draw_triangle_strips_instanced(std::size_t indices, std::size_t instances, std::size_t base_instance)
+{
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLE_STRIP,
+		indices,
+		to_underlying(bound_index_type()),
+		0,
+		instances,
+		base_instance);
+}
+
+void draw_triangles(const MeshRange& range)
+{
+	glDrawElementsBaseVertex(GL_TRIANGLES,
+		range.count,
+		to_underlying(bound_index_type()),
+		(void*) (range.first_index * index_size(bound_index_type())),
+		range.base_vertex);
+}
+
+void draw_triangles_instanced(const MeshRange& range, std::size_t instances, std::size_t base_instance)
+{
+	glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,
+		range.count,
+		to_underlying(bound_index_type()),
+		(void*) (range.first_index * index_size(bound_index_type())),
+		instances,
+		range.base_vertex,
+		base_instance);
+}
+
+void draw_triangles_indirect(const BufferBase& commands, std::size_t draws, std::size_t offset)
+{
+	StateCache::get().bind_buffer(GL_DRAW_INDIRECT_BUFFER, commands.id());
+	glMultiDrawElementsIndirect(GL_TRIANGLES, to_underlying(bound_index_type()), (void*) offset, draws, 0);
+}
+
+void draw_triangles_indirect_count(const BufferBase& commands,
+		const BufferBase& parameters,
+		std::size_t max_draws,
+		std::size_t parameter_offset)
+{
+	if (!supports_indirect_count())
 	{
-		glDisable(GL_BLEND);
+		draw_triangles_indirect(commands, max_draws);
+		return;
 	}
+
+	StateCache::get().bind_buffer(GL_DRAW_INDIRECT_BUFFER, commands.id());
+	StateCache::get().bind_buffer(GL_PARAMETER_BUFFER, parameters.id());
+	multi_draw_indirect_count(0, parameter_offset, max_draws);
+}
+
+bool supports_indirect_count()
+{
+	return GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_indirect_parameters;
+}
+
+bool supports_parallel_compile()
+{
+	return GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+}
+
+void set_alpha(bool value)
+{
+	StateCache::get().set_blend(value);
+	if (value)
+		StateCache::get().set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 auto get_version() -> std::string
@@ -2,11 +2,19 @@
 #ifndef WRAPPERS_HPP_
 #define WRAPPERS_HPP_
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <initializer_list>
+#include <future>
+#include <list>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -14,9 +22,11 @@
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <gsl/span>
 
+#include "allocator.hpp"
 #include "rect.hpp"
 
 struct __GLsync;
@@ -42,6 +52,16 @@ constexpr int vec_dimensions() noexcept
 	return decltype(detail::vec_dimensions_impl(std::declval<T>()))::value;
 }
 
+template <class T>
+struct is_tuple : std::false_type
+{
+};
+
+template <class ... Ts>
+struct is_tuple<std::tuple<Ts...>> : std::true_type
+{
+};
+
 template <std::size_t I, class T>
 constexpr std::size_t tuple_element_offset() noexcept
 {
@@ -50,6 +70,135 @@ constexpr std::size_t tuple_element_offset() noexcept
 
 } // namespace detail
 
+/*
+ * Vertex attribute stored as integers, normalized to [0, 1] or [-1, 1] in the shader
+ */
+template <class Vec>
+struct Normalized
+{
+	Normalized() = default;
+	Normalized(Vec v) : value(v) {}
+
+	Vec value;
+};
+
+/*
+ * Vertex attribute kept as integers in the shader (ivec, uvec inputs)
+ */
+template <class Vec>
+struct Integer
+{
+	Integer() = default;
+	Integer(Vec v) : value(v) {}
+
+	Vec value;
+};
+
+/*
+ * Vertex attribute of N half precision floats
+ */
+template <int N>
+struct Half
+{
+	Half() = default;
+	Half(glm::vec<N, float> v)
+	{
+		for (int i = 0; i < N; ++i)
+			bits[i] = glm::packHalf1x16(v[i]);
+	}
+
+	std::array<std::uint16_t, N> bits = {};
+};
+
+/*
+ * Normalized signed 10/10/10/2 vertex attribute (GL_INT_2_10_10_10_REV)
+ * Suited to normals and tangents
+ */
+struct PackedNormal
+{
+	PackedNormal() = default;
+	PackedNormal(glm::vec4 v) : bits(glm::packSnorm3x10_1x2(v)) {}
+	PackedNormal(glm::vec3 v) : PackedNormal(glm::vec4(v, 0.0f)) {}
+
+	std::uint32_t bits = 0;
+};
+
+namespace detail
+{
+
+template <class T>
+constexpr std::uint32_t gl_type()
+{
+	if constexpr (std::is_same_v<T, std::int8_t>)
+		return 0x1400;
+	if constexpr (std::is_same_v<T, std::uint8_t>)
+		return 0x1401;
+	if constexpr (std::is_same_v<T, std::int16_t>)
+		return 0x1402;
+	if constexpr (std::is_same_v<T, std::uint16_t>)
+		return 0x1403;
+	if constexpr (std::is_same_v<T, std::int32_t>)
+		return 0x1404;
+	if constexpr (std::is_same_v<T, std::uint32_t>)
+		return 0x1405;
+	if constexpr (std::is_same_v<T, float>)
+		return 0x1406;
+	throw std::logic_error("type to int");
+}
+
+/*
+ * Format of a vertex attribute type, as passed to glVertexArrayAttrib*Format
+ */
+template <class T, class = void>
+struct vertex_attribute
+{
+	static constexpr std::uint32_t type = gl_type<typename T::value_type>();
+	static constexpr int count = vec_dimensions<T>();
+	static constexpr bool normalized = false;
+	static constexpr bool integer = false;
+};
+
+template <class T>
+struct vertex_attribute<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+	static constexpr std::uint32_t type = gl_type<T>();
+	static constexpr int count = 1;
+	static constexpr bool normalized = false;
+	static constexpr bool integer = false;
+};
+
+template <class Vec>
+struct vertex_attribute<Normalized<Vec>> : vertex_attribute<Vec>
+{
+	static constexpr bool normalized = true;
+};
+
+template <class Vec>
+struct vertex_attribute<Integer<Vec>> : vertex_attribute<Vec>
+{
+	static constexpr bool integer = true;
+};
+
+template <int N>
+struct vertex_attribute<Half<N>>
+{
+	static constexpr std::uint32_t type = 0x140B;
+	static constexpr int count = N;
+	static constexpr bool normalized = false;
+	static constexpr bool integer = false;
+};
+
+template <>
+struct vertex_attribute<PackedNormal>
+{
+	static constexpr std::uint32_t type = 0x8D9F;
+	static constexpr int count = 4;
+	static constexpr bool normalized = true;
+	static constexpr bool integer = false;
+};
+
+} // namespace detail
+
 #define TUPLE_TYPE(index, tuple_type) std::tuple_element_t<index, tuple_type>
 #define TUPLE_OFFSET(index, tuple_type) detail::tuple_element_offset<index, tuple_type>()
 #define TUPLE_FOR_EACH(expr) (void) detail::swallow_t {((expr), 0)...}
@@ -93,6 +242,16 @@ enum class InternalFormat : std::uint32_t
 	depth_component = 0x1902,
 };
 
+/*
+ * Element types of an IndexBuffer
+ */
+enum class IndexType : std::uint32_t
+{
+	u8  = 0x1401,
+	u16 = 0x1403,
+	u32 = 0x1405,
+};
+
 /*
  * Types of attachments for a Framebuffer
  */
@@ -209,6 +368,14 @@ public:
 	~ComputeShaderHandle();
 };
 
+class ShaderHandle : public ResourceHandle
+{
+public:
+	explicit ShaderHandle(std::uint32_t type);
+	ShaderHandle(ShaderHandle&&) = default;
+	~ShaderHandle();
+};
+
 class ShaderProgramHandle : public ResourceHandle
 {
 public:
@@ -241,6 +408,14 @@ public:
 	~ArrayTexture2DHandle();
 };
 
+class ProgramPipelineHandle : public ResourceHandle
+{
+public:
+	ProgramPipelineHandle();
+	ProgramPipelineHandle(ProgramPipelineHandle&&) = default;
+	~ProgramPipelineHandle();
+};
+
 class MeshHandle : public ResourceHandle
 {
 public:
@@ -350,6 +525,33 @@ using Shader = std::variant<VertexShader,
 		FragmentShader,
 		ComputeShader>;
 
+/*
+ * Shader stages, matching the GL shader types
+ */
+enum class ShaderStage : std::uint32_t
+{
+	vertex          = 0x8B31,
+	geometry        = 0x8DD9,
+	tess_control    = 0x8E88,
+	tess_evaluation = 0x8E87,
+	fragment        = 0x8B30,
+	compute         = 0x91B9,
+};
+
+/*
+ * Uncompiled shader, kept around so programs can be cached or rebuilt
+ */
+struct ShaderSource
+{
+	ShaderStage stage;
+	std::string source;
+};
+
+// Compile source into the Shader alternative of its stage
+auto compile(const ShaderSource& source) -> Shader;
+
+auto shader_id(const Shader& shader) noexcept -> std::uint32_t;
+
 struct ShaderVec
 {
 	ShaderVec(std::vector<Shader>&& shaders)
@@ -360,16 +562,69 @@ struct ShaderVec
 	std::vector<Shader> impl;
 };
 
+/*
+ * Driver specific program binary, only valid for the driver that produced it
+ */
+struct ProgramBinary
+{
+	std::uint32_t format = 0;
+	std::vector<std::byte> data;
+};
+
+/*
+ * Active uniform found at link time, block members are not listed
+ * Arrays are listed once under their name without [0]
+ */
+struct UniformInfo
+{
+	std::string name;
+	std::int32_t location;
+	std::uint32_t type;
+	std::int32_t size;
+};
+
+/*
+ * Active uniform or shader storage block found at link time
+ */
+struct BlockInfo
+{
+	std::string name;
+	std::uint32_t index;
+	std::uint32_t binding;
+	std::size_t size_bytes;
+};
+
+using UniformValue = std::variant<int,
+		unsigned,
+		float,
+		double,
+		glm::vec2,
+		glm::vec3,
+		glm::vec4,
+		glm::mat4>;
+
 /*
  * A fully compiled and linked shader program
  * Must be bound before issuing draw calls
+ *
+ * Uniform names are resolved once at link time. The last value set at each
+ * location is shadowed so unchanged values skip the GL call; values written
+ * to the program behind its back are not seen.
  */
 class ShaderProgram
 {
 public:
 	ShaderProgram() = delete;
-	explicit ShaderProgram(const ShaderVec& shaders);
+
+	// Retrievable programs hint the driver to keep their binary() around
+	explicit ShaderProgram(const ShaderVec& shaders, bool retrievable = false);
 	ShaderProgram(const VertexShader& vert, const FragmentShader& frag);
+
+	// Link shader objects that stay owned elsewhere, e.g. shared between programs
+	explicit ShaderProgram(gsl::span<const std::uint32_t> shaders, bool retrievable = false);
+
+	// Throws ShaderException if the driver rejects the binary
+	explicit ShaderProgram(const ProgramBinary& binary);
 	ShaderProgram(ShaderProgram&& other) = default;
 	~ShaderProgram() = default;
 
@@ -382,10 +637,148 @@ public:
 	void set_uniform(std::uint32_t location, glm::vec4 value);
 	void set_uniform(std::uint32_t location, const glm::mat4& value);
 
+	// Unknown names are ignored, like location -1 in GL
+	template <class T>
+	void set_uniform(std::string_view name, const T& value)
+	{
+		if (const auto uniform = location(name); uniform >= 0)
+			set_uniform(static_cast<std::uint32_t>(uniform), value);
+	}
+
+	// Set many uniforms at once, e.g. set_uniforms({{"model", model}, {"tint", tint}})
+	void set_uniforms(std::initializer_list<std::pair<std::string_view, UniformValue>> values);
+
 	void bind() const;
 
+	// -1 if name is not an active uniform
+	auto location(std::string_view name) const -> std::int32_t;
+
+	auto uniforms() const noexcept -> const std::vector<UniformInfo>&;
+	auto uniform_blocks() const noexcept -> const std::vector<BlockInfo>&;
+	auto storage_blocks() const noexcept -> const std::vector<BlockInfo>&;
+
+	// nullptr if name is not an active block
+	auto uniform_block(std::string_view name) const noexcept -> const BlockInfo*;
+	auto storage_block(std::string_view name) const noexcept -> const BlockInfo*;
+
+	// Number of set_uniform calls skipped because the value was unchanged
+	auto redundant_uniforms() const noexcept -> std::size_t;
+
+	auto binary() const -> ProgramBinary;
+	auto id() const noexcept -> std::uint32_t;
+
+protected:
+	// Takes over a linked program
+	explicit ShaderProgram(ShaderProgramHandle&& handle);
+
 private:
+	friend class ProgramBuilder;
+
+	struct UniformShadow
+	{
+		std::array<std::byte, sizeof(glm::mat4)> value;
+		std::size_t type = std::variant_npos; // UniformValue alternative
+	};
+
 	ShaderProgramHandle handle;
+	std::vector<UniformInfo> _uniforms;
+	std::vector<BlockInfo> _uniform_blocks;
+	std::vector<BlockInfo> _storage_blocks;
+	std::vector<UniformShadow> shadow;
+	std::size_t _redundant_uniforms = 0;
+
+	void reflect();
+
+	// Returns false if location already holds value
+	template <class T>
+	auto update_shadow(std::uint32_t location, const T& value) -> bool;
+};
+
+/*
+ * Single stage program linked with GL_PROGRAM_SEPARABLE for use in a ProgramPipeline
+ * Vertex, tessellation and geometry stages should redeclare gl_PerVertex
+ */
+class StageProgram : public ShaderProgram
+{
+public:
+	explicit StageProgram(const ShaderSource& source);
+	explicit StageProgram(const Shader& shader);
+	StageProgram(StageProgram&&) = default;
+
+	auto stage() const noexcept -> ShaderStage;
+
+private:
+	ShaderStage _stage;
+};
+
+/*
+ * Mixes separable stage programs without linking, bind() replaces any bound ShaderProgram
+ */
+class ProgramPipeline
+{
+public:
+	ProgramPipeline() = default;
+	ProgramPipeline(ProgramPipeline&&) = default;
+
+	// Replace the program of the stage
+	void use(const StageProgram& program);
+	void clear(ShaderStage stage);
+
+	void bind() const;
+
+	// Throws ShaderException if the stages don't fit together
+	void validate() const;
+
+	auto id() const noexcept -> std::uint32_t;
+
+private:
+	ProgramPipelineHandle handle;
+};
+
+/*
+ * Compiles and links programs without waiting on each one
+ *
+ * All compiles and links are issued up front and the driver works on them
+ * in its own threads when KHR_parallel_shader_compile is available. Finished
+ * programs are handed to their callback from poll(), failures are logged.
+ * Without the extension poll() completes one program per call.
+ */
+class ProgramBuilder
+{
+public:
+	using Callback = std::function<void(ShaderProgram&&)>;
+
+	// Zero threads lets the driver pick
+	explicit ProgramBuilder(std::uint32_t threads = 0);
+
+	void build(const std::vector<ShaderSource>& sources, Callback callback);
+
+	// Failed builds throw ShaderException from get()
+	auto build_future(const std::vector<ShaderSource>& sources) -> std::future<ShaderProgram>;
+
+	// Complete every finished build, call once per frame
+	void poll();
+
+	// Block until every queued build has completed
+	void finish();
+
+	auto pending() const noexcept -> std::size_t;
+	auto failures() const noexcept -> std::size_t;
+
+private:
+	struct Job
+	{
+		ShaderProgramHandle program;
+		std::vector<ShaderHandle> shaders;
+		Callback callback;
+		std::function<void()> failed;
+	};
+
+	std::list<Job> jobs;
+	std::size_t _failures = 0;
+
+	void submit(const std::vector<ShaderSource>& sources, Callback callback, std::function<void()> failed);
+	void complete(Job& job);
 };
 
 class FenceSync
@@ -455,133 +848,479 @@ public:
 	{
 	}
 
+	explicit ArrayBuffer(gsl::span<const T> data)
+	: BufferBase(gsl::as_bytes(data))
+	{
+	}
+
 	auto size() const noexcept -> std::size_t
 	{
 		return size_bytes() / sizeof(T);
 	}
 };
 
-class BufferStreamBase
+/*
+ * GPU allocated mutable buffer with a cpu side shadow copy
+ * Writes mark byte ranges dirty, flush() uploads the merged ranges
+ */
+class DynamicBufferBase
 {
 public:
-	explicit BufferStreamBase(std::size_t size_bytes);
+	explicit DynamicBufferBase(gsl::span<const std::byte> buffer);
+
+	// Throw BufferException if the range is outside the buffer
+	void write(std::size_t offset, gsl::span<const std::byte> data);
+	void mark_dirty(std::size_t offset, std::size_t size);
 
-	void update(std::function<void(gsl::span<std::byte>)> f);
+	// Upload all dirty ranges, call once per frame before drawing
+	void flush();
 
 	void bind_to_uniform(std::size_t index) const;
 	void bind_to_storage(std::size_t index) const;
 
+	auto data() const noexcept -> gsl::span<const std::byte>;
 	auto id() const noexcept -> std::uint32_t;
-	auto current_slot() const noexcept -> std::size_t;
-	auto slots() const noexcept -> std::size_t;
 	auto size_bytes() const noexcept -> std::size_t;
 
 protected:
-	void write_lock_acquire();
-	void write_lock_release();
-	auto slot_span() const noexcept -> gsl::span<std::byte>;
+	auto shadow_span() noexcept -> gsl::span<std::byte>;
+
+	// Throw BufferException unless [first, first + count) elements lie in the buffer
+	void check_elements(std::size_t first, std::size_t count, std::size_t element_size) const;
 
 private:
-	std::array<FenceSync, 3> fences = {};
-	gsl::span<std::byte> buffer;
-	std::size_t slot;
+	std::vector<std::byte> shadow;
+	std::vector<std::pair<std::size_t, std::size_t>> dirty;
 	BufferHandle handle;
 };
 
+/*
+ * GPU allocated mutable array buffer
+ */
 template <class T>
-class BufferStream : public BufferStreamBase
+class DynamicArrayBuffer : public DynamicBufferBase
 {
 public:
 	using value_type = T;
 
-	BufferStream()
-	: BufferStreamBase(sizeof(T))
+	explicit DynamicArrayBuffer(const std::vector<T>& vec)
+	: DynamicBufferBase(gsl::as_bytes(gsl::span<const T>(vec)))
 	{
 	}
 
-	template <class ... Args>
-	void update(Args&& ... args)
+	void set(std::size_t index, const T& value)
 	{
-		write_lock_acquire();
-		auto span = slot_span();
-		auto casted_span = gsl::span<T>(reinterpret_cast<T*>(span.data()), 1);
-		casted_span.front() = T{std::forward<Args>(args)...};
-		write_lock_release();
+		check_elements(index, 1, sizeof(T));
+		values()[index] = value;
+		mark_dirty(index * sizeof(T), sizeof(T));
 	}
-};
-
-template <class T>
-class ArrayBufferStream : public BufferStreamBase
-{
-public:
-	using value_type = T;
 
-	explicit ArrayBufferStream(std::size_t size)
-	: BufferStreamBase(size * sizeof(T))
+	// f receives a span over [first, first + count) that is marked dirty
+	template <class F>
+	void update(std::size_t first, std::size_t count, F&& f)
 	{
+		check_elements(first, count, sizeof(T));
+		f(values().subspan(first, count));
+		mark_dirty(first * sizeof(T), count * sizeof(T));
 	}
 
-	void update(std::function<void(gsl::span<T>)> f)
+	auto operator[](std::size_t index) const noexcept -> const T&
 	{
-		write_lock_acquire();
-		auto span = slot_span();
-		auto casted_span = gsl::span<T>(reinterpret_cast<T*>(span.data()), span.size() / sizeof(T));
-		f(casted_span);
-		write_lock_release();
+		return reinterpret_cast<const T*>(data().data())[index];
 	}
 
 	auto size() const noexcept -> std::size_t
 	{
 		return size_bytes() / sizeof(T);
 	}
+
+private:
+	auto values() noexcept -> gsl::span<T>
+	{
+		auto span = shadow_span();
+		return gsl::span<T>(reinterpret_cast<T*>(span.data()), span.size() / sizeof(T));
+	}
 };
 
-using IndexBuffer = ArrayBuffer<std::uint32_t>;
+template <class T>
+class BufferStreamWriter;
 
 /*
- * A gpu side 2D texture
- * Must be bound before issuing draw calls
+ * How writes to a persistently mapped stream are made visible to the gpu
  */
-class Texture2D
+enum class StreamMode
 {
-public:
-	Texture2D(std::size_t width, std::size_t height, InternalFormat internal_format);
-	explicit Texture2D(const Image& image, InternalFormat internal_format);
-
-	void set_anti_aliasing(bool value);
-	void bind(std::uint32_t unit = 0) const;
-
-	auto id() const noexcept -> std::uint32_t;
-	auto width() const noexcept -> std::size_t;
-	auto height() const noexcept -> std::size_t;
+	barrier,        // client mapped buffer barrier after every write
+	explicit_flush, // only the ranges reported by the writer are flushed
+	coherent,       // coherent mapping, no flush or barrier
+};
 
-private:
-	Texture2DHandle handle;
-	std::size_t _width;
-	std::size_t _height;
+/*
+ * How a MeshStream points its attributes at the slot being drawn
+ */
+enum class StreamBinding
+{
+	port_per_slot, // one port per slot, every attribute switches port on update
+	rebind,        // one port, its buffer offset moves on update
+	base_vertex,   // one port over the whole ring, draws add base_vertex()
 };
 
-class ArrayTexture2D
+class BufferStreamBase
 {
 public:
-	ArrayTexture2D(std::size_t width, std::size_t height, std::size_t layers, InternalFormat internal_format);
-	ArrayTexture2D(const std::vector<Image>& images, InternalFormat internal_format);
-	ArrayTexture2D(const std::vector<ImagePtr>& images, InternalFormat internal_format);
-	ArrayTexture2D(const Image& sprite_sheet, std::size_t cell_width, InternalFormat internal_format);
+	explicit BufferStreamBase(std::size_t size_bytes, StreamMode mode = StreamMode::barrier);
 
-	void set_anti_aliasing(bool value);
-	void bind_to_unit(std::uint32_t unit) const;
+	auto begin_write() -> BufferStreamWriter<std::byte>;
+
+	template <class F>
+	void update(F&& f);
+
+	void bind_to_uniform(std::size_t index) const;
+	void bind_to_storage(std::size_t index) const;
 
 	auto id() const noexcept -> std::uint32_t;
-	auto width() const noexcept -> std::size_t;
-	auto height() const noexcept -> std::size_t;
-	auto layers() const noexcept -> std::size_t;
+	auto current_slot() const noexcept -> std::size_t;
+	auto slots() const noexcept -> std::size_t;
+	auto size_bytes() const noexcept -> std::size_t;
+	auto mode() const noexcept -> StreamMode;
+
+protected:
+	void write_lock_acquire();
+	void write_lock_release();
+	void mark_written(std::size_t offset, std::size_t size);
+	auto slot_span() const noexcept -> gsl::span<std::byte>;
 
 private:
-	ArrayTexture2DHandle handle;
-	std::size_t _width;
-	std::size_t _height;
-	std::size_t _layers;
+	template <class T>
+	friend class BufferStreamWriter;
+
+	std::array<FenceSync, 3> fences = {};
+	std::vector<std::pair<std::size_t, std::size_t>> written;
+	gsl::span<std::byte> buffer;
+	std::size_t slot;
+	StreamMode _mode;
+	BufferHandle handle;
+};
+
+/*
+ * Scoped write access to the next slot of a BufferStreamBase
+ * The slot is released to the gpu when the writer is destroyed
+ */
+template <class T>
+class BufferStreamWriter
+{
+public:
+	explicit BufferStreamWriter(BufferStreamBase& stream)
+	: stream(&stream)
+	{
+		stream.write_lock_acquire();
+		auto bytes = stream.slot_span();
+		_span = gsl::span<T>(reinterpret_cast<T*>(bytes.data()), bytes.size() / sizeof(T));
+	}
+
+	BufferStreamWriter(BufferStreamWriter&& other) noexcept
+	: stream(other.stream)
+	, _span(other._span)
+	, released(other.released)
+	, context(other.context)
+	{
+		other.stream = nullptr;
+	}
+
+	~BufferStreamWriter()
+	{
+		if (stream)
+		{
+			stream->write_lock_release();
+			if (released)
+				released(context);
+		}
+	}
+
+	// deleted copy + assign
+	BufferStreamWriter(const BufferStreamWriter& other) = delete;
+	BufferStreamWriter& operator=(const BufferStreamWriter& other) = delete;
+	BufferStreamWriter& operator=(BufferStreamWriter&& other) = delete;
+
+	auto span() const noexcept -> gsl::span<T>
+	{
+		return _span;
+	}
+
+	// Report [first, first + count) as written, used by StreamMode::explicit_flush
+	// The whole slot is flushed when nothing is reported
+	void mark_written(std::size_t first, std::size_t count)
+	{
+		stream->mark_written(first * sizeof(T), count * sizeof(T));
+	}
+
+	// Run f(context) after the slot is released, e.g. to point draws at it
+	// The released slot is still the stream's current_slot() when f runs
+	void on_release(void (*f)(void*), void* __context) noexcept
+	{
+		released = f;
+		context = __context;
+	}
+
+private:
+	BufferStreamBase* stream;
+	gsl::span<T> _span;
+	void (*released)(void*) = nullptr;
+	void* context = nullptr;
+};
+
+template <class F>
+void BufferStreamBase::update(F&& f)
+{
+	auto writer = begin_write();
+	f(writer.span());
+}
+
+template <class T>
+class BufferStream : public BufferStreamBase
+{
+public:
+	using value_type = T;
+
+	explicit BufferStream(StreamMode mode = StreamMode::barrier)
+	: BufferStreamBase(sizeof(T), mode)
+	{
+	}
+
+	auto begin_write() -> BufferStreamWriter<T>
+	{
+		return BufferStreamWriter<T>(*this);
+	}
+
+	template <class ... Args>
+	void update(Args&& ... args)
+	{
+		auto writer = begin_write();
+		writer.span().front() = T{std::forward<Args>(args)...};
+	}
+};
+
+template <class T>
+class ArrayBufferStream : public BufferStreamBase
+{
+public:
+	using value_type = T;
+
+	explicit ArrayBufferStream(std::size_t size, StreamMode mode = StreamMode::barrier)
+	: BufferStreamBase(size * sizeof(T), mode)
+	{
+	}
+
+	auto begin_write() -> BufferStreamWriter<T>
+	{
+		return BufferStreamWriter<T>(*this);
+	}
+
+	template <class F>
+	void update(F&& f)
+	{
+		auto writer = begin_write();
+		f(writer.span());
+	}
+
+	auto size() const noexcept -> std::size_t
+	{
+		return size_bytes() / sizeof(T);
+	}
+};
+
+class BufferException : public std::runtime_error
+{
+public:
+	BufferException();
+};
+
+/*
+ * A region of a TransientBuffer valid until the end of the frame
+ */
+struct TransientAllocation
+{
+	gsl::span<std::byte> data;
+	std::size_t offset = 0;
+};
+
+/*
+ * Persistently mapped ring buffer for small per-draw allocations
+ * (uniform blocks, dynamic vertices, indirect commands)
+ * Space is reclaimed once the gpu has finished the frame it was allocated in
+ */
+class TransientBuffer
+{
+public:
+	explicit TransientBuffer(std::size_t size_bytes);
+
+	auto allocate(std::size_t size_bytes, std::size_t alignment) -> TransientAllocation;
+	auto allocate_uniform(std::size_t size_bytes) -> TransientAllocation;
+	auto allocate_storage(std::size_t size_bytes) -> TransientAllocation;
+
+	template <class T>
+	auto push_uniform(const T& value) -> TransientAllocation
+	{
+		auto allocation = allocate_uniform(sizeof(T));
+		std::memcpy(allocation.data.data(), &value, sizeof(T));
+		return allocation;
+	}
+
+	template <class T>
+	auto push_storage(gsl::span<const T> values) -> TransientAllocation
+	{
+		auto allocation = allocate_storage(values.size_bytes());
+		std::memcpy(allocation.data.data(), values.data(), values.size_bytes());
+		return allocation;
+	}
+
+	// Fence the current frame's allocations and reclaim the oldest frame
+	void end_frame();
+
+	void bind_to_uniform(std::size_t index, const TransientAllocation& allocation) const;
+	void bind_to_storage(std::size_t index, const TransientAllocation& allocation) const;
+
+	auto id() const noexcept -> std::uint32_t;
+	auto size_bytes() const noexcept -> std::size_t;
+	auto uniform_alignment() const noexcept -> std::size_t;
+	auto storage_alignment() const noexcept -> std::size_t;
+
+private:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	std::array<FenceSync, 3> fences = {};
+	std::array<std::size_t, 3> frame_ends;
+	gsl::span<std::byte> buffer;
+	std::size_t frame = 0;
+	std::size_t head = 0;
+	std::size_t tail = 0;
+	std::size_t _uniform_alignment = 1;
+	std::size_t _storage_alignment = 1;
+	BufferHandle handle;
+
+	void reclaim(std::size_t index);
+	bool reclaim_oldest();
+};
+
+// Size of a single index in bytes
+auto index_size(IndexType type) noexcept -> std::size_t;
+
+// Smallest index type able to address every index
+auto smallest_index_type(const std::vector<std::uint32_t>& indices) noexcept -> IndexType;
+
+// Convert indices to the given type, throws BufferException if one does not fit
+auto pack_indices(const std::vector<std::uint32_t>& indices, IndexType type) -> std::vector<std::byte>;
+
+/*
+ * GPU allocated index buffer of 8, 16 or 32 bit indices
+ * 32 bit indices are narrowed to 16 bits when every index fits
+ */
+class IndexBuffer : public BufferBase
+{
+public:
+	explicit IndexBuffer(const std::vector<std::uint32_t>& indices);
+	IndexBuffer(const std::vector<std::uint32_t>& indices, IndexType type);
+	explicit IndexBuffer(gsl::span<const std::uint16_t> indices);
+	explicit IndexBuffer(gsl::span<const std::uint8_t> indices);
+
+	// Indices already packed as type, e.g. from a MeshFile
+	IndexBuffer(gsl::span<const std::byte> indices, IndexType type);
+
+	auto type() const noexcept -> IndexType;
+	auto size() const noexcept -> std::size_t;
+
+private:
+	IndexType _type;
+};
+
+/*
+ * Large gpu buffer sub-allocated into many static ranges
+ * Offsets and sizes are measured in elements of element_size bytes
+ * Grows and defragments by copying into a new buffer, so id() may change
+ */
+class BufferPoolBase
+{
+public:
+	BufferPoolBase(std::size_t element_size, std::size_t capacity);
+
+	auto allocate(gsl::span<const std::byte> data) -> std::uint32_t;
+	void free(std::uint32_t range);
+	void defragment();
+
+	auto offset(std::uint32_t range) const noexcept -> std::size_t;
+	auto size(std::uint32_t range) const noexcept -> std::size_t;
+	auto capacity() const noexcept -> std::size_t;
+	auto id() const noexcept -> std::uint32_t;
+
+private:
+	std::size_t element_size;
+	RangeAllocator allocator;
+	std::unique_ptr<BufferHandle> handle;
+
+	void reallocate(std::size_t capacity, const std::vector<RangeMove>& moves);
+};
+
+template <class T>
+class BufferPool : public BufferPoolBase
+{
+public:
+	using value_type = T;
+
+	explicit BufferPool(std::size_t capacity)
+	: BufferPoolBase(sizeof(T), capacity)
+	{
+	}
+
+	auto allocate(const std::vector<T>& vec) -> std::uint32_t
+	{
+		return BufferPoolBase::allocate(gsl::as_bytes(gsl::span<const T>(vec)));
+	}
+};
+
+/*
+ * A gpu side 2D texture
+ * Must be bound before issuing draw calls
+ */
+class Texture2D
+{
+public:
+	Texture2D(std::size_t width, std::size_t height, InternalFormat internal_format);
+	explicit Texture2D(const Image& image, InternalFormat internal_format);
+
+	void set_anti_aliasing(bool value);
+	void bind(std::uint32_t unit = 0) const;
+
+	auto id() const noexcept -> std::uint32_t;
+	auto width() const noexcept -> std::size_t;
+	auto height() const noexcept -> std::size_t;
+
+private:
+	Texture2DHandle handle;
+	std::size_t _width;
+	std::size_t _height;
+};
+
+class ArrayTexture2D
+{
+public:
+	ArrayTexture2D(std::size_t width, std::size_t height, std::size_t layers, InternalFormat internal_format);
+	ArrayTexture2D(const std::vector<Image>& images, InternalFormat internal_format);
+	ArrayTexture2D(const std::vector<ImagePtr>& images, InternalFormat internal_format);
+	ArrayTexture2D(const Image& sprite_sheet, std::size_t cell_width, InternalFormat internal_format);
+
+	void set_anti_aliasing(bool value);
+	void bind_to_unit(std::uint32_t unit) const;
+
+	auto id() const noexcept -> std::uint32_t;
+	auto width() const noexcept -> std::size_t;
+	auto height() const noexcept -> std::size_t;
+	auto layers() const noexcept -> std::size_t;
+
+private:
+	ArrayTexture2DHandle handle;
+	std::size_t _width;
+	std::size_t _height;
+	std::size_t _layers;
 };
 
 /*
@@ -593,20 +1332,61 @@ class MeshBase
 public:
 	void attach(const IndexBuffer& indices);
 
+	/*
+	 * Read attributes [first_attrib, first_attrib + n) once per divisor instances
+	 * The buffer's value_type is a single attribute or a tuple of n attributes
+	 */
+	template <class T>
+	void attach_instances(const T& buffer, std::uint32_t first_attrib, std::uint32_t divisor = 1)
+	{
+		using value_type = typename T::value_type;
+
+		set_port_buffer(instance_port, buffer, port_offset(buffer));
+		set_port_divisor(instance_port, divisor);
+
+		if constexpr (detail::is_tuple<value_type>::value)
+		{
+			attach_instance_attribs<value_type>(first_attrib,
+					std::make_index_sequence<std::tuple_size_v<value_type>>());
+		}
+		else
+		{
+			set_attrib_format<value_type>(first_attrib, 0);
+			set_attrib_port(first_attrib, instance_port);
+		}
+	}
+
+	// Follow the current slot of a streamed instance buffer, call after each update
+	template <class T>
+	void update_instances(const ArrayBufferStream<T>& buffer)
+	{
+		set_port_buffer(instance_port, buffer, port_offset(buffer));
+	}
+
 	auto id() const noexcept -> std::uint32_t;
+	auto index_type() const noexcept -> IndexType;
+
+	// Draw calls use the index type of the bound mesh
 	void bind() const;
 	void unbind() const;
 
 protected:
+	// Binding port reserved for per-instance attributes
+	static constexpr std::uint32_t instance_port = 15;
+
+	void set_index_buffer(std::uint32_t buffer, IndexType type);
 	void set_attrib_port(std::uint32_t attrib, std::uint32_t port);
+	void set_port_divisor(std::uint32_t port, std::uint32_t divisor);
 
-	template <class Vec>
+	template <class T>
 	void set_attrib_format(std::uint32_t attrib, std::size_t type_offset)
 	{
-		using T = typename Vec::value_type;
+		using format = detail::vertex_attribute<T>;
 		set_attrib_format(attrib,
-				type_to_int<T>(),
-				detail::vec_dimensions<Vec>(),
+				format::type,
+				format::count,
+				format::normalized,
+				format::integer,
 				type_offset);
 	}
 
@@ -620,30 +1400,35 @@ protected:
 
 private:
 	MeshHandle handle;
+	IndexType _index_type = IndexType::u32;
 
-	template <class T>
-	constexpr std::uint32_t type_to_int()
-	{
-		if constexpr (std::is_same_v<T, std::int8_t>)
-			return 0x1400;
-		if constexpr (std::is_same_v<T, std::uint8_t>)
-			return 0x1401;
-		if constexpr (std::is_same_v<T, std::int16_t>)
-			return 0x1402;
-		if constexpr (std::is_same_v<T, std::uint16_t>)
-			return 0x1403;
-		if constexpr (std::is_same_v<T, std::int32_t>)
-			return 0x1404;
-		if constexpr (std::is_same_v<T, std::uint32_t>)
-			return 0x1405;
-		if constexpr (std::is_same_v<T, float>)
-			return 0x1406;
-		throw std::logic_error("type to int");
+	static auto port_offset(const BufferBase&) noexcept -> std::size_t
+	{
+		return 0;
+	}
+
+	static auto port_offset(const BufferStreamBase& buffer) noexcept -> std::size_t
+	{
+		return buffer.current_slot() * buffer.size_bytes();
+	}
+
+	static auto port_offset(const DynamicBufferBase&) noexcept -> std::size_t
+	{
+		return 0;
+	}
+
+	template <class Tuple, std::size_t ... Is>
+	void attach_instance_attribs(std::uint32_t first_attrib, std::index_sequence<Is...>)
+	{
+		TUPLE_FOR_EACH(set_attrib_format<TUPLE_TYPE(Is, Tuple)>(first_attrib + Is, TUPLE_OFFSET(Is, Tuple)));
+		TUPLE_FOR_EACH(set_attrib_port(first_attrib + Is, instance_port));
 	}
 
 	void set_attrib_format(std::uint32_t attrib,
 			std::uint32_t type,
 			std::size_t type_count,
+			bool normalized,
+			bool integer,
 			std::size_t type_offset);
 
 	void set_port_buffer(std::uint32_t port,
@@ -697,39 +1482,83 @@ class MeshStream : public MeshBase
 public:
 	using value_type = std::tuple<Ts...>;
 
-	MeshStream(std::size_t vertices, const IndexBuffer& indices)
-	: vertices(vertices)
+	MeshStream(std::size_t vertices,
+			const IndexBuffer& indices,
+			StreamMode mode = StreamMode::barrier,
+			StreamBinding binding = StreamBinding::port_per_slot)
+	: vertices(vertices, mode)
+	, _binding(binding)
+	, drawn_slot(this->vertices.current_slot())
 	{
 		attach_vertices(std::make_index_sequence<sizeof...(Ts)>());
 		MeshBase::attach(indices);
 	}
 
-	MeshStream(ArrayBufferStream<value_type>&& vertices, const IndexBuffer& indices)
+	MeshStream(ArrayBufferStream<value_type>&& vertices,
+			const IndexBuffer& indices,
+			StreamBinding binding = StreamBinding::port_per_slot)
 	: vertices(std::move(vertices))
+	, _binding(binding)
+	, drawn_slot(this->vertices.current_slot())
 	{
 		attach_vertices(std::make_index_sequence<sizeof...(Ts)>());
 		MeshBase::attach(indices);
 	}
 
-	void update(std::function<void(gsl::span<value_type>)> f)
+	// Draws keep reading the previous slot until the writer is released
+	auto begin_write() -> BufferStreamWriter<value_type>
 	{
-		vertices.update(f);
-		update_ports(vertices.current_slot(), std::make_index_sequence<sizeof...(Ts)>());
+		auto writer = vertices.begin_write();
+		writer.on_release([](void* mesh) { static_cast<MeshStream*>(mesh)->written(); }, this);
+		return writer;
+	}
+
+	template <class F>
+	void update(F&& f)
+	{
+		auto writer = begin_write();
+		f(writer.span());
+	}
+
+	// Add to the base vertex of every draw in StreamBinding::base_vertex, zero otherwise
+	auto base_vertex() const noexcept -> std::size_t
+	{
+		return _binding == StreamBinding::base_vertex ? drawn_slot * vertices.size() : 0;
+	}
+
+	auto binding() const noexcept -> StreamBinding
+	{
+		return _binding;
 	}
 
 private:
 	ArrayBufferStream<value_type> vertices;
+	StreamBinding _binding;
+	std::size_t drawn_slot;
 
 	template <std::size_t ... Is>
 	void attach_vertices(std::index_sequence<Is...>)
 	{
-		// Bind each buffer slot to a different port
-		for (std::size_t i = 0; i < vertices.slots(); ++i)
-			set_port_buffer(i, vertices, i * vertices.size_bytes());
+		if (_binding == StreamBinding::port_per_slot)
+		{
+			// Bind each buffer slot to a different port
+			for (std::size_t i = 0; i < vertices.slots(); ++i)
+				set_port_buffer(i, vertices, i * vertices.size_bytes());
+		}
+		else if (_binding == StreamBinding::rebind)
+		{
+			set_port_buffer(0, vertices, vertices.current_slot() * vertices.size_bytes());
+		}
+		else
+		{
+			// One port over the whole ring
+			set_port_buffer(0, vertices, 0);
+		}
 
 		// Init attrib formats/ports
+		const auto port = _binding == StreamBinding::port_per_slot ? vertices.current_slot() : 0;
 		TUPLE_FOR_EACH(set_attrib_format<TUPLE_TYPE(Is, value_type)>(Is, TUPLE_OFFSET(Is, value_type)));
-		TUPLE_FOR_EACH(set_attrib_port(Is, vertices.current_slot()));
+		TUPLE_FOR_EACH(set_attrib_port(Is, port));
 	}
 
 	template <std::size_t ... Is>
@@ -737,6 +1566,275 @@ private:
 	{
 		TUPLE_FOR_EACH(set_attrib_port(Is, port));
 	}
+
+	// Point draws at the slot that was just released
+	void written()
+	{
+		const auto slot = vertices.current_slot();
+		drawn_slot = slot;
+		switch (_binding)
+		{
+		case StreamBinding::port_per_slot:
+			update_ports(slot, std::make_index_sequence<sizeof...(Ts)>());
+			break;
+		case StreamBinding::rebind:
+			set_port_buffer(0, vertices, slot * vertices.size_bytes());
+			break;
+		case StreamBinding::base_vertex:
+			break;
+		}
+	}
+};
+
+/*
+ * Marks a SoaMesh attribute as streamed, its buffer can be rewritten every frame
+ */
+template <class T>
+struct Streamed
+{
+	using value_type = T;
+};
+
+namespace detail
+{
+
+template <class T>
+struct soa_attribute
+{
+	using type = T;
+	using buffer_type = ArrayBuffer<T>;
+	static constexpr bool streamed = false;
+};
+
+template <class T>
+struct soa_attribute<Streamed<T>>
+{
+	using type = T;
+	using buffer_type = ArrayBufferStream<T>;
+	static constexpr bool streamed = true;
+};
+
+} // namespace detail
+
+/*
+ * Holds non-interleaved vertex data for draw calls
+ * Each attribute lives in its own buffer and binding port
+ *
+ * Example: SoaMesh<Streamed<vec3>, vec2> keeps streamed positions
+ * 	        next to static uvs, positions are rewritten with update<0>(...)
+ */
+template <class ... Ts>
+class SoaMesh : public MeshBase
+{
+public:
+	template <std::size_t I>
+	using attribute_type = typename detail::soa_attribute<std::tuple_element_t<I, std::tuple<Ts...>>>::type;
+
+	SoaMesh(const std::vector<typename detail::soa_attribute<Ts>::type>& ... attributes,
+			const IndexBuffer& indices)
+	: buffers(make_buffer<Ts>(attributes)...)
+	{
+		attach_attributes(std::make_index_sequence<sizeof...(Ts)>());
+		MeshBase::attach(indices);
+	}
+
+	template <std::size_t I>
+	auto begin_write() -> BufferStreamWriter<attribute_type<I>>
+	{
+		static_assert(detail::soa_attribute<std::tuple_element_t<I, std::tuple<Ts...>>>::streamed,
+				"attribute is not streamed");
+
+		// Draws keep reading the previous slot until the writer is released
+		auto writer = std::get<I>(buffers).begin_write();
+		writer.on_release([](void* mesh) { static_cast<SoaMesh*>(mesh)->written<I>(); }, this);
+		return writer;
+	}
+
+	template <std::size_t I, class F>
+	void update(F&& f)
+	{
+		auto writer = begin_write<I>();
+		f(writer.span());
+	}
+
+private:
+	std::tuple<typename detail::soa_attribute<Ts>::buffer_type...> buffers;
+
+	// Point draws at the slot of attribute I that was just released
+	template <std::size_t I>
+	void written()
+	{
+		auto& stream = std::get<I>(buffers);
+		set_port_buffer(I, stream, stream.current_slot() * stream.size_bytes());
+	}
+
+	template <class T>
+	static auto make_buffer(const std::vector<typename detail::soa_attribute<T>::type>& data)
+	-> typename detail::soa_attribute<T>::buffer_type
+	{
+		using buffer_type = typename detail::soa_attribute<T>::buffer_type;
+
+		if constexpr (detail::soa_attribute<T>::streamed)
+		{
+			buffer_type stream(data.size());
+			stream.update([&data](auto span) { std::copy(data.begin(), data.end(), span.begin()); });
+			return stream;
+		}
+		else
+		{
+			return buffer_type(data);
+		}
+	}
+
+	template <std::size_t I>
+	void attach_attribute()
+	{
+		const auto& buffer = std::get<I>(buffers);
+
+		if constexpr (detail::soa_attribute<std::tuple_element_t<I, std::tuple<Ts...>>>::streamed)
+			set_port_buffer(I, buffer, buffer.current_slot() * buffer.size_bytes());
+		else
+			set_port_buffer(I, buffer, 0);
+
+		set_attrib_format<attribute_type<I>>(I, 0);
+		set_attrib_port(I, I);
+	}
+
+	template <std::size_t ... Is>
+	void attach_attributes(std::index_sequence<Is...>)
+	{
+		TUPLE_FOR_EACH(attach_attribute<Is>());
+	}
+};
+
+/*
+ * Draw parameters of a single mesh inside a MeshPool
+ */
+struct MeshRange
+{
+	std::size_t base_vertex = 0;
+	std::size_t first_index = 0;
+	std::size_t count = 0;
+};
+
+/*
+ * Handle to a mesh allocated from a MeshPool
+ */
+struct PooledMesh
+{
+	std::uint32_t vertices = RangeAllocator::invalid;
+	std::uint32_t indices = RangeAllocator::invalid;
+};
+
+/*
+ * Packs many static meshes of the same vertex format into shared buffers
+ * Bind once, then draw each mesh with draw_triangles(pool.range(mesh))
+ * Indices are relative to the mesh's own vertices, so 16 bit indices
+ * only limit the vertex count of each mesh, not of the pool
+ */
+template <class ... Ts>
+class MeshPool : public MeshBase
+{
+public:
+	using value_type = std::tuple<Ts...>;
+
+	MeshPool(std::size_t vertex_capacity,
+			std::size_t index_capacity,
+			IndexType index_type = IndexType::u32)
+	: vertices(vertex_capacity)
+	, indices(index_size(index_type), index_capacity)
+	{
+		set_index_buffer(indices.id(), index_type);
+		attach_vertices(std::make_index_sequence<sizeof...(Ts)>());
+	}
+
+	auto allocate(const std::vector<value_type>& vertex_data,
+			const std::vector<std::uint32_t>& index_data) -> PooledMesh
+	{
+		auto packed = pack_indices(index_data, index_type());
+		auto mesh = PooledMesh{vertices.allocate(vertex_data), indices.allocate(packed)};
+		attach_buffers();
+		return mesh;
+	}
+
+	void free(const PooledMesh& mesh)
+	{
+		vertices.free(mesh.vertices);
+		indices.free(mesh.indices);
+	}
+
+	void defragment()
+	{
+		vertices.defragment();
+		indices.defragment();
+		attach_buffers();
+	}
+
+	auto range(const PooledMesh& mesh) const noexcept -> MeshRange
+	{
+		return {vertices.offset(mesh.vertices), indices.offset(mesh.indices), indices.size(mesh.indices)};
+	}
+
+private:
+	BufferPool<value_type> vertices;
+	BufferPoolBase indices;
+
+	void attach_buffers()
+	{
+		// pools may have been reallocated
+		set_port_buffer(0, vertices, 0);
+		set_index_buffer(indices.id(), index_type());
+	}
+
+	template <std::size_t ... Is>
+	void attach_vertices(std::index_sequence<Is...>)
+	{
+		attach_buffers();
+		TUPLE_FOR_EACH(set_attrib_format<TUPLE_TYPE(Is, value_type)>(Is, TUPLE_OFFSET(Is, value_type)));
+		TUPLE_FOR_EACH(set_attrib_port(Is, 0));
+	}
+};
+
+/*
+ * Indirect draw command, laid out as DrawElementsIndirectCommand
+ */
+struct DrawElementsCommand
+{
+	std::uint32_t count = 0;
+	std::uint32_t instance_count = 0;
+	std::uint32_t first_index = 0;
+	std::int32_t base_vertex = 0;
+	std::uint32_t base_instance = 0;
+};
+
+/*
+ * Records draws of meshes sharing one MeshPool and submits them
+ * with a single glMultiDrawElementsIndirect, or its count variant
+ */
+class DrawBatch
+{
+public:
+	explicit DrawBatch(std::size_t capacity = 1024);
+
+	void add(const MeshRange& range, std::size_t instances = 1, std::size_t base_instance = 0);
+	void clear() noexcept;
+
+	// Upload the recorded commands and draw them from the currently bound MeshPool
+	void submit();
+
+	// As submit(), but the draw count is read from parameters on the gpu, e.g. after
+	// a compute pass rewrote the commands. Draws every command when unsupported
+	void submit(const BufferBase& parameters, std::size_t parameter_offset = 0);
+
+	auto size() const noexcept -> std::size_t;
+	auto capacity() const noexcept -> std::size_t;
+
+private:
+	std::vector<DrawElementsCommand> commands;
+	std::unique_ptr<ArrayBufferStream<DrawElementsCommand>> indirect;
+
+	// Returns the byte offset of the uploaded commands
+	auto upload() -> std::size_t;
 };
 
 /*
@@ -774,6 +1872,7 @@ public:
 
 	void bind() const;
 
+	auto id() const noexcept -> std::uint32_t;
 	auto width() const noexcept -> std::size_t;
 	auto height() const noexcept -> std::size_t;
 
@@ -783,6 +1882,65 @@ private:
 	std::size_t _height = 0;
 };
 
+/*
+ * Asynchronous gpu to cpu readback through a persistently mapped pack buffer ring
+ * Copies are queued on the gpu and complete a few frames later in poll()
+ * The span given to a callback is only valid for the duration of the call
+ */
+class Readback
+{
+public:
+	using Callback = std::function<void(gsl::span<const std::byte>)>;
+
+	explicit Readback(std::size_t size_bytes);
+
+	void read(const BufferBase& buffer, std::size_t offset, std::size_t size, Callback callback);
+	void read(const Texture2D& texture, const iRect2D& region, ImageFormat format, Callback callback);
+	void read(const Framebuffer& framebuffer, const iRect2D& region, ImageFormat format, Callback callback);
+
+	// Read from the default framebuffer
+	void read(const iRect2D& region, ImageFormat format, Callback callback);
+
+	template <class ... Args>
+	auto read_future(Args&& ... args) -> std::future<std::vector<std::byte>>
+	{
+		auto promise = std::make_shared<std::promise<std::vector<std::byte>>>();
+		auto future = promise->get_future();
+		read(std::forward<Args>(args)..., [promise](gsl::span<const std::byte> data)
+		{
+			promise->set_value(std::vector<std::byte>(data.begin(), data.end()));
+		});
+		return future;
+	}
+
+	// Complete every finished request, call once per frame
+	void poll();
+
+	// Block until every queued request has completed
+	void finish();
+
+	auto pending() const noexcept -> std::size_t;
+
+private:
+	struct Request
+	{
+		FenceSync fence;
+		std::size_t offset;
+		std::size_t size;
+		Callback callback;
+	};
+
+	std::deque<Request> requests;
+	gsl::span<std::byte> buffer;
+	std::size_t head = 0;
+	BufferHandle handle;
+
+	auto allocate(std::size_t size) -> std::size_t;
+	void submit(std::size_t offset, std::size_t size, Callback&& callback);
+	void complete_oldest();
+	void read_pixels(std::uint32_t framebuffer, const iRect2D& region, ImageFormat format, Callback&& callback);
+};
+
 // Clear the default framebuffer
 void clear(glm::vec4 rgba, float depth = 1.0f);
 
@@ -791,6 +1949,30 @@ void draw_triangles(std::size_t n);
 void draw_triangle_strips(std::size_t n);
 void draw_triangle_strips_instanced(std::size_t indices, std::size_t instances);
 
+// Draw instances [base_instance, base_instance + instances) from the currently bound Mesh
+void draw_triangles_instanced(std::size_t indices, std::size_t instances, std::size_t base_instance = 0);
+void draw_triangle_strips_instanced(std::size_t indices, std::size_t instances, std::size_t base_instance);
+
+// Draw a single mesh from the currently bound MeshPool
+void draw_triangles(const MeshRange& range);
+void draw_triangles_instanced(const MeshRange& range, std::size_t instances, std::size_t base_instance = 0);
+
+// Draw DrawElementsCommands from an indirect buffer with the currently bound Mesh
+void draw_triangles_indirect(const BufferBase& commands, std::size_t draws, std::size_t offset = 0);
+
+// Draw count is read from parameters on the gpu, falls back to max_draws
+// commands when unsupported (unused commands must have zero instances)
+void draw_triangles_indirect_count(const BufferBase& commands,
+		const BufferBase& parameters,
+		std::size_t max_draws,
+		std::size_t parameter_offset = 0);
+
+// GL 4.6 or ARB_indirect_parameters glMultiDrawElementsIndirectCount
+bool supports_indirect_count();
+
+// KHR_parallel_shader_compile or ARB_parallel_shader_compile
+bool supports_parallel_compile();
+
 // Enable alpha blending
 void set_alpha(bool value);
 